@@ -0,0 +1,301 @@
+// Copyright (C) 2020 Juri Dispan
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+// Place, Suite 330, Boston, MA 02111-1307 USA
+
+#ifndef AHO_CORASICK_HPP
+#define AHO_CORASICK_HPP
+
+#include "trie.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// An Aho-Corasick automaton that finds all occurrences of the keys of a
+// Trie<std::string, ...> in a text in a single pass, reporting each
+// occurrence together with the key's value.
+// Bytes that occur in no key are mapped to one common class, so the
+// transition table only needs as many columns as there are distinct bytes in
+// the keys. If the full table (one entry per state and class) has at most
+// max_dense_entries entries, every byte of the text costs one table lookup.
+// Otherwise, only the transitions of the trie are stored, and failure links
+// are followed at scan time.
+// Empty keys are ignored.
+template <typename ValueType> class AhoCorasick {
+public:
+  // The position of a scan within a text, so that a text can be scanned in
+  // chunks. Matches that span several chunks are found as well.
+  struct Position {
+    std::uint32_t state = 0;
+    std::size_t offset = 0;
+  };
+
+  // Keys can be given by any trie of strings with a storage that supports
+  // lookups in key order.
+  template <typename Storage, std::size_t root_table_size>
+  explicit AhoCorasick(const Trie<std::string, ValueType,
+                                  DummyConverter<std::string>, Storage,
+                                  root_table_size> &patterns,
+                       std::size_t max_dense_entries = std::size_t{1} << 24)
+      : classes(), class_count(1), fail(), output(1, none),
+        output_link(), lengths(), values(), dense(), child_begin(),
+        child_class(), child_state() {
+    for (auto it = patterns.ordered_begin(); it != patterns.ordered_end();
+         ++it) {
+      for (unsigned char byte : it.key()) {
+        if (!classes[byte]) {
+          classes[byte] = static_cast<std::uint8_t>(class_count++);
+        }
+      }
+    }
+    std::vector<std::vector<std::pair<std::uint8_t, std::uint32_t>>> children(
+        1);
+    for (auto it = patterns.ordered_begin(); it != patterns.ordered_end();
+         ++it) {
+      add_pattern(it.key(), it.value(), children);
+    }
+    for (auto &edges : children) {
+      std::sort(edges.begin(), edges.end());
+    }
+    sort_breadth_first(children);
+    fail.resize(children.size(), 0);
+    output_link.resize(children.size(), none);
+    link(children);
+    // dense entries must fit into 31 bits
+    if (children.size() * class_count <=
+        std::min(max_dense_entries, std::size_t{1} << 31)) {
+      make_dense(children);
+    } else {
+      make_sparse(children);
+    }
+  }
+
+  // Calls on_match(begin, length, value) for every occurrence of a key in the
+  // text, where begin is the offset of the occurrence from the start of the
+  // scan. Occurrences are reported in the order of their ends; occurrences
+  // ending at the same byte are reported longest first.
+  template <typename F> void scan(std::string_view text, F on_match) const {
+    Position position;
+    scan(text, on_match, position);
+  }
+
+  // Continues a scan at the given position and updates it.
+  template <typename F>
+  void scan(std::string_view text, F on_match, Position &position) const {
+    std::uint32_t state = position.state;
+    if (is_dense()) {
+      std::size_t row = std::size_t{state} * class_count;
+      for (std::size_t i = 0; i != text.size(); i++) {
+        std::uint32_t entry =
+            dense[row + classes[static_cast<unsigned char>(text[i])]];
+        row = entry >> 1;
+        if (entry & 1) {
+          report(static_cast<std::uint32_t>(row / class_count),
+                 position.offset + i + 1, on_match);
+        }
+      }
+      state = static_cast<std::uint32_t>(row / class_count);
+    } else {
+      for (std::size_t i = 0; i != text.size(); i++) {
+        state =
+            next_sparse(state, classes[static_cast<unsigned char>(text[i])]);
+        report(state, position.offset + i + 1, on_match);
+      }
+    }
+    position.state = state;
+    position.offset += text.size();
+  }
+
+  // Whether the automaton uses a full transition table.
+  bool is_dense() const noexcept { return !dense.empty(); }
+
+private:
+  static constexpr std::uint32_t none = UINT32_MAX;
+
+  // Reports the keys that end in the state, at the given offset.
+  template <typename F>
+  void report(std::uint32_t state, std::size_t end, F &on_match) const {
+    std::uint32_t match = output[state] != none ? state : output_link[state];
+    while (match != none) {
+      std::uint32_t pattern = output[match];
+      on_match(end - lengths[pattern], lengths[pattern], values[pattern]);
+      match = output_link[match];
+    }
+  }
+
+  void add_pattern(
+      const std::string &pattern, const ValueType &value,
+      std::vector<std::vector<std::pair<std::uint8_t, std::uint32_t>>>
+          &children) {
+    if (pattern.empty()) {
+      return;
+    }
+    std::uint32_t state = 0;
+    for (unsigned char byte : pattern) {
+      std::uint8_t byte_class = classes[byte];
+      auto edge = std::find_if(children[state].begin(), children[state].end(),
+                               [&](auto &e) { return e.first == byte_class; });
+      if (edge != children[state].end()) {
+        state = edge->second;
+        continue;
+      }
+      std::uint32_t next = static_cast<std::uint32_t>(children.size());
+      children[state].emplace_back(byte_class, next);
+      children.emplace_back();
+      output.push_back(none);
+      state = next;
+    }
+    output[state] = static_cast<std::uint32_t>(lengths.size());
+    lengths.push_back(pattern.size());
+    values.push_back(value);
+  }
+
+  // Renumbers the states in breadth-first order. Then the states of short
+  // prefixes, which the scan visits most often, are close together in the
+  // tables, and every state's failure state has a smaller number.
+  void sort_breadth_first(
+      std::vector<std::vector<std::pair<std::uint8_t, std::uint32_t>>>
+          &children) {
+    std::vector<std::uint32_t> order{0};
+    for (std::size_t head = 0; head != order.size(); head++) {
+      for (auto &edge : children[order[head]]) {
+        order.push_back(edge.second);
+      }
+    }
+    std::vector<std::uint32_t> number(order.size());
+    for (std::size_t i = 0; i != order.size(); i++) {
+      number[order[i]] = static_cast<std::uint32_t>(i);
+    }
+    std::vector<std::vector<std::pair<std::uint8_t, std::uint32_t>>> sorted(
+        order.size());
+    std::vector<std::uint32_t> sorted_output(order.size());
+    for (std::size_t i = 0; i != order.size(); i++) {
+      sorted[i] = std::move(children[order[i]]);
+      for (auto &edge : sorted[i]) {
+        edge.second = number[edge.second];
+      }
+      sorted_output[i] = output[order[i]];
+    }
+    children = std::move(sorted);
+    output = std::move(sorted_output);
+  }
+
+  // Computes failure and output links. The links of a state are those of its
+  // parent extended by one symbol, so parents must be done first.
+  void link(
+      const std::vector<std::vector<std::pair<std::uint8_t, std::uint32_t>>>
+          &children) {
+    for (std::uint32_t state = 0; state != children.size(); state++) {
+      for (auto &[byte_class, child] : children[state]) {
+        fail[child] = 0;
+        for (std::uint32_t f = fail[state]; state != 0; f = fail[f]) {
+          auto edge = std::lower_bound(
+              children[f].begin(), children[f].end(),
+              std::make_pair(byte_class, std::uint32_t{0}));
+          if (edge != children[f].end() && edge->first == byte_class) {
+            fail[child] = edge->second;
+            break;
+          }
+          if (f == 0) {
+            break;
+          }
+        }
+        output_link[child] = output[fail[child]] != none
+                                 ? fail[child]
+                                 : output_link[fail[child]];
+      }
+    }
+  }
+
+  void make_dense(
+      const std::vector<std::vector<std::pair<std::uint8_t, std::uint32_t>>>
+          &children) {
+    dense.assign(children.size() * class_count, 0);
+    for (std::size_t state = 0; state != children.size(); state++) {
+      // transitions that are not in the trie are those of the failure state,
+      // which has a smaller number and is thus already complete
+      if (state != 0) {
+        std::copy_n(dense.begin() + fail[state] * class_count, class_count,
+                    dense.begin() + state * class_count);
+      }
+      for (auto &[byte_class, child] : children[state]) {
+        bool matches = output[child] != none || output_link[child] != none;
+        dense[state * class_count + byte_class] =
+            static_cast<std::uint32_t>(child * class_count << 1 | matches);
+      }
+    }
+  }
+
+  void make_sparse(
+      const std::vector<std::vector<std::pair<std::uint8_t, std::uint32_t>>>
+          &children) {
+    child_begin.reserve(children.size() + 1);
+    for (auto &edges : children) {
+      child_begin.push_back(static_cast<std::uint32_t>(child_class.size()));
+      for (auto &[byte_class, child] : edges) {
+        child_class.push_back(byte_class);
+        child_state.push_back(child);
+      }
+    }
+    child_begin.push_back(static_cast<std::uint32_t>(child_class.size()));
+  }
+
+  std::uint32_t next_sparse(std::uint32_t state,
+                            std::uint8_t byte_class) const {
+    while (true) {
+      auto first = child_class.begin() + child_begin[state];
+      auto last = child_class.begin() + child_begin[state + 1];
+      auto edge = std::lower_bound(first, last, byte_class);
+      if (edge != last && *edge == byte_class) {
+        return child_state[edge - child_class.begin()];
+      }
+      if (state == 0) {
+        return 0;
+      }
+      state = fail[state];
+    }
+  }
+
+  // Class of every byte; 0 for bytes that occur in no key.
+  std::array<std::uint8_t, 256> classes;
+  std::size_t class_count;
+
+  // Per state: failure link, index of the key ending here (or none), and the
+  // nearest state on the failure path where a key ends (or none).
+  std::vector<std::uint32_t> fail;
+  std::vector<std::uint32_t> output;
+  std::vector<std::uint32_t> output_link;
+
+  // Per key: its length and value.
+  std::vector<std::size_t> lengths;
+  std::vector<ValueType> values;
+
+  // Full transition table, indexed by state * class_count + class. Entries
+  // hold the index of the next state's row (state * class_count) shifted left
+  // by one; the lowest bit is set if a key ends in the next state.
+  std::vector<std::uint32_t> dense;
+
+  // Otherwise, the trie's transitions of state s are
+  // child_class/child_state[child_begin[s] .. child_begin[s + 1]).
+  std::vector<std::uint32_t> child_begin;
+  std::vector<std::uint8_t> child_class;
+  std::vector<std::uint32_t> child_state;
+};
+
+#endif
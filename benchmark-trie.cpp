@@ -17,15 +17,44 @@
 
 #include "catch2/catch.hpp"
 #include "trie.hpp"
+#include "ip_fib.hpp"
+#include "critbit.hpp"
+#include "aho_corasick.hpp"
 #include <ext/pb_ds/assoc_container.hpp>
 #include <map>
 
+#include <algorithm>
+#include <array>
+
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <new>
+#include <optional>
+#include <random>
+#include <regex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+// The global operator new is replaced so that the benchmarks can report how
+// many allocations an operation causes.
+static std::size_t allocation_count = 0;
+
+void *operator new(std::size_t size) {
+  allocation_count++;
+  if (void *p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
 // A custom converter for using strings only containing the characters A-Za-z as
 // keys. This precondition is not checked.
 // In order to use this converter, instatiate a trie with
@@ -50,6 +79,14 @@ using ContainerType =
 using ContainerType =
     Trie<std::string, std::size_t, AlphabeticalStringConverter,
          ArrayStorage<std::string, char, std::size_t, 52>>;
+#elif BM_HYBRID
+using ContainerType =
+    Trie<std::string, std::size_t, DummyConverter<std::string>,
+         HybridStorage<std::string, char, std::size_t, 256>>;
+#elif BM_ROOT_TABLE
+using ContainerType =
+    Trie<std::string, std::size_t, DummyConverter<std::string>,
+         MapStorage<std::string, char, std::size_t>, 256>;
 #elif BM_UNORDERED_MAP
 using ContainerType =
     Trie<std::string, std::size_t, DummyConverter<std::string>,
@@ -58,10 +95,32 @@ using ContainerType =
 using ContainerType = std::map<std::string, std::size_t>;
 #elif BM_GNU_TRIE
 using ContainerType = __gnu_pbds::trie<std::string, std::size_t>;
+#elif BM_CRITBIT
+using ContainerType = CritBitTree<std::string, std::size_t>;
 #else
 using ContainerType = Trie<std::string, std::size_t>;
 #endif
 
+// Containers for the keyword set benchmark. Only the test case "Keyword set"
+// is meant to be run with these settings.
+#if BM_SET
+using SetContainerType = TrieSet<std::string>;
+#elif BM_SET_BOOL
+using SetContainerType = Trie<std::string, bool>;
+#endif
+
+// Some benchmarks use operations that only our tries support.
+#if !BM_STD_MAP && !BM_GNU_TRIE && !BM_CRITBIT
+#define BM_TRIE 1
+#endif
+
+// Benchmarks that use their own container types instead of ContainerType only
+// need to run in the default configuration.
+#if BM_TRIE && !BM_ARRAY && !BM_ARRAY_CUSTOM && !BM_HYBRID &&                 \
+    !BM_ROOT_TABLE && !BM_UNORDERED_MAP && !BM_SET && !BM_SET_BOOL
+#define BM_DEFAULT 1
+#endif
+
 std::vector<std::pair<std::string, std::size_t>> read_words() {
   std::vector<std::pair<std::string, std::size_t>> v{};
   std::ifstream wordlist("res/unix-words.txt");
@@ -127,4 +186,1075 @@ TEST_CASE("Iterate over trie") {
     CHECK(sum == 2257221);
     return sum;
   };
-}
\ No newline at end of file
+}
+
+// Two copies of the trie using ArrayStorage don't fit into memory.
+#if BM_TRIE && !BM_ARRAY
+TEST_CASE("Compact trie") {
+  // insert in random order, so that nodes are scattered across the heap
+  auto sorted = read_words();
+  auto shuffled = sorted;
+  std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(42));
+  ContainerType structure = prepare_word_container(shuffled);
+
+  auto query_all = [&](std::vector<std::pair<std::string, std::size_t>> &v) {
+    std::size_t sum = 0;
+    for (auto &p : v) {
+      sum += *structure.at(p.first);
+    }
+    return sum;
+  };
+  auto iterate = [&] {
+    std::size_t sum = 0;
+    for (auto entry : structure) {
+      sum += entry.second;
+    }
+    return sum;
+  };
+
+  BENCHMARK("Query words in sorted order before compact()") {
+    return query_all(sorted);
+  };
+  BENCHMARK("Query words in random order before compact()") {
+    return query_all(shuffled);
+  };
+  BENCHMARK("Iterate before compact()") { return iterate(); };
+
+  structure.compact();
+
+  BENCHMARK("Query words in sorted order after compact()") {
+    return query_all(sorted);
+  };
+  BENCHMARK("Query words in random order after compact()") {
+    return query_all(shuffled);
+  };
+  BENCHMARK("Iterate after compact()") { return iterate(); };
+}
+#endif
+
+#if BM_SET || BM_SET_BOOL
+TEST_CASE("Keyword set") {
+  // The set is only built once, so that the maximum resident set size
+  // reported by benchmark_memory reflects the size of one set.
+  auto vec = read_words();
+  SetContainerType set;
+  for (auto &p : vec) {
+#if BM_SET
+    set.insert(p.first);
+#else
+    set[p.first] = true;
+#endif
+  }
+
+  BENCHMARK("Check membership of all words") {
+    std::size_t found = 0;
+    for (auto &p : vec) {
+#if BM_SET
+      found += set.contains(p.first);
+#else
+      found += set.has_key(p.first);
+#endif
+    }
+    return found;
+  };
+}
+#endif
+
+// AlphabeticalStringConverter can only read std::strings.
+#if BM_TRIE && !BM_ARRAY_CUSTOM
+TEST_CASE("Query with other key types") {
+  auto vec = read_words();
+  ContainerType structure = prepare_word_container(vec);
+  // Long words, so that constructing a std::string for them allocates.
+  std::vector<std::string_view> queries{};
+  for (auto &p : vec) {
+    if (p.first.size() > 15) {
+      queries.push_back(p.first);
+    }
+  }
+
+  auto query_strings = [&] {
+    std::size_t sum = 0;
+    for (std::string_view query : queries) {
+      sum += *structure.at(std::string(query));
+    }
+    return sum;
+  };
+  auto query_views = [&] {
+    std::size_t sum = 0;
+    for (std::string_view query : queries) {
+      sum += *structure.at(query);
+    }
+    return sum;
+  };
+
+  std::size_t before = allocation_count;
+  query_strings();
+  std::size_t string_allocations = allocation_count - before;
+  before = allocation_count;
+  query_views();
+  std::size_t view_allocations = allocation_count - before;
+  std::cout << "Allocations for " << queries.size()
+            << " lookups: " << string_allocations << " with std::string, "
+            << view_allocations << " with std::string_view\n";
+  CHECK(view_allocations == 0);
+
+  BENCHMARK("Query long words as std::string") { return query_strings(); };
+  BENCHMARK("Query long words as std::string_view") { return query_views(); };
+}
+#endif
+
+#if BM_DEFAULT
+TEST_CASE("Large values") {
+  struct LargeValue {
+    std::array<std::size_t, 32> data;
+  };
+  static_assert(sizeof(LargeValue) == 256);
+
+  auto vec = read_words();
+  auto make_value = [](std::size_t n) {
+    LargeValue value{};
+    value.data.fill(n);
+    return value;
+  };
+
+  BENCHMARK("Build with insert()") {
+    Trie<std::string, LargeValue> trie;
+    for (auto &p : vec) {
+      trie.insert(p.first, make_value(p.second));
+    }
+    return trie;
+  };
+  BENCHMARK("Build with try_emplace()") {
+    Trie<std::string, LargeValue> trie;
+    for (auto &p : vec) {
+      trie.try_emplace(p.first, make_value(p.second));
+    }
+    return trie;
+  };
+
+  Trie<std::string, LargeValue> trie;
+  for (auto &p : vec) {
+    trie.try_emplace(p.first, make_value(p.second));
+  }
+  BENCHMARK("Query all words with at()") {
+    std::size_t sum = 0;
+    for (auto &p : vec) {
+      sum += trie.at(p.first)->data[31];
+    }
+    return sum;
+  };
+  BENCHMARK("Query all words with find()") {
+    std::size_t sum = 0;
+    for (auto &p : vec) {
+      sum += trie.find(p.first)->data[31];
+    }
+    return sum;
+  };
+}
+#endif
+
+#if BM_TRIE
+TEST_CASE("Counters") {
+  // A few thousand hot keys that are updated over and over again.
+  auto vec = read_words();
+  std::vector<std::string> hot_keys{};
+  for (std::size_t i = 0; i < vec.size(); i += vec.size() / 4096) {
+    hot_keys.push_back(vec[i].first);
+  }
+  std::vector<std::size_t> updates(1000000);
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<std::size_t> pick(0, hot_keys.size() - 1);
+  for (auto &update : updates) {
+    update = pick(rng);
+  }
+
+  ContainerType structure = prepare_word_container(vec);
+  std::vector<ContainerType::NodeHandle> handles{};
+  for (auto &key : hot_keys) {
+    handles.push_back(structure.handle(key));
+  }
+
+  BENCHMARK("Update counters with operator[]") {
+    for (std::size_t update : updates) {
+      *structure[hot_keys[update]] += 1;
+    }
+    return structure.at(hot_keys[0]);
+  };
+  BENCHMARK("Update counters with handles") {
+    for (std::size_t update : updates) {
+      **handles[update] += 1;
+    }
+    return structure.at(hot_keys[0]);
+  };
+}
+#endif
+
+// Splits 16 MiB of text into words of a 50k-word vocabulary.
+#if BM_TRIE && !BM_ARRAY_CUSTOM
+TEST_CASE("Tokenize") {
+  auto vec = read_words();
+  std::mt19937 rng(42);
+  std::shuffle(vec.begin(), vec.end(), rng);
+  vec.resize(50000);
+  ContainerType vocabulary = prepare_word_container(vec);
+  std::size_t max_length = 0;
+  for (auto &p : vec) {
+    max_length = std::max(max_length, p.first.size());
+  }
+  std::string text;
+  std::uniform_int_distribution<std::size_t> word{0, vec.size() - 1};
+  while (text.size() < (std::size_t{1} << 24)) {
+    text += vec[word(rng)].first;
+    text += ' ';
+  }
+  std::vector<ContainerType::Token> tokens;
+  tokens.reserve(text.size());
+
+  BENCHMARK("Tokenize 16 MiB with tokenize()") {
+    tokens.clear();
+    vocabulary.tokenize(text, std::back_inserter(tokens));
+    return tokens.size();
+  };
+  // only the first MiB, as this is much slower
+  BENCHMARK("Tokenize 1 MiB with has_key()") {
+    std::string_view rest(text.data(), std::size_t{1} << 20);
+    std::size_t count = 0;
+    while (!rest.empty()) {
+      std::size_t length = std::min(max_length, rest.size());
+      while (length > 0 && !vocabulary.has_key(rest.substr(0, length))) {
+        length--;
+      }
+      rest.remove_prefix(std::max(length, std::size_t{1}));
+      count++;
+    }
+    return count;
+  };
+}
+#endif
+
+// Spelling suggestions for 100 misspelled words.
+#if BM_TRIE && !BM_ARRAY_CUSTOM
+std::size_t edit_distance(std::string_view a, std::string_view b) {
+  std::vector<std::size_t> row(b.size() + 1);
+  for (std::size_t j = 0; j <= b.size(); j++) {
+    row[j] = j;
+  }
+  for (std::size_t i = 1; i <= a.size(); i++) {
+    std::size_t diagonal = row[0];
+    row[0] = i;
+    for (std::size_t j = 1; j <= b.size(); j++) {
+      std::size_t above = row[j];
+      row[j] = std::min(
+          {row[j] + 1, row[j - 1] + 1, diagonal + (a[i - 1] != b[j - 1])});
+      diagonal = above;
+    }
+  }
+  return row[b.size()];
+}
+
+TEST_CASE("Fuzzy search") {
+  auto vec = read_words();
+  ContainerType structure = prepare_word_container(vec);
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<std::size_t> word{0, vec.size() - 1};
+  std::uniform_int_distribution<char> letter{'a', 'z'};
+  std::vector<std::string> queries;
+  while (queries.size() < 100) {
+    std::string query = vec[word(rng)].first;
+    std::size_t pos = rng() % query.size();
+    switch (rng() % 3) {
+    case 0:
+      query[pos] = letter(rng);
+      break;
+    case 1:
+      query.insert(pos, 1, letter(rng));
+      break;
+    case 2:
+      query.erase(pos, 1);
+      break;
+    }
+    queries.push_back(query);
+  }
+
+  BENCHMARK("Fuzzy search 100 words, 1 edit") {
+    std::size_t found = 0;
+    for (auto &query : queries) {
+      found += structure.fuzzy_search(query, 1).size();
+    }
+    return found;
+  };
+  BENCHMARK("Fuzzy search 100 words, 2 edits") {
+    std::size_t found = 0;
+    for (auto &query : queries) {
+      found += structure.fuzzy_search(query, 2).size();
+    }
+    return found;
+  };
+#if BM_DEFAULT
+  BENCHMARK("Fuzzy search 100 words, 2 edits, all words") {
+    std::size_t found = 0;
+    for (auto &query : queries) {
+      for (auto &p : vec) {
+        found += edit_distance(query, p.first) <= 2;
+      }
+    }
+    return found;
+  };
+#endif
+}
+#endif
+
+// Wildcard and regex queries against the word list.
+#if BM_TRIE && !BM_ARRAY_CUSTOM
+TEST_CASE("Pattern search") {
+  auto vec = read_words();
+  ContainerType structure = prepare_word_container(vec);
+  auto c_t = KeyPattern<char>::glob("c?t");
+  auto pseudo = KeyPattern<char>::glob("pseudo*tion");
+  auto tion = KeyPattern<char>::glob("*tion");
+  auto able = KeyPattern<char>::regex("(un|re)[a-z]*able");
+
+  BENCHMARK("Pattern search c?t") {
+    return structure.pattern_search(c_t).size();
+  };
+  BENCHMARK("Pattern search pseudo*tion") {
+    return structure.pattern_search(pseudo).size();
+  };
+  BENCHMARK("Pattern search *tion") {
+    return structure.pattern_search(tion).size();
+  };
+  BENCHMARK("Pattern search (un|re)[a-z]*able") {
+    return structure.pattern_search(able).size();
+  };
+#if BM_DEFAULT
+  // what the search replaces: iterating over all keys with std::regex
+  std::regex tion_regex(".*tion");
+  std::regex able_regex("(un|re)[a-z]*able");
+  BENCHMARK("std::regex .*tion over all keys") {
+    std::size_t found = 0;
+    for (auto it = structure.begin(); it != structure.end(); ++it) {
+      found += std::regex_match(it.key(), tion_regex);
+    }
+    return found;
+  };
+  BENCHMARK("std::regex (un|re)[a-z]*able over all keys") {
+    std::size_t found = 0;
+    for (auto it = structure.begin(); it != structure.end(); ++it) {
+      found += std::regex_match(it.key(), able_regex);
+    }
+    return found;
+  };
+#endif
+}
+#endif
+
+// Simulates type-ahead search: after every keystroke, check whether the typed
+// prefix is a word and whether any word starts with it.
+#if BM_TRIE && !BM_ARRAY_CUSTOM
+TEST_CASE("Typing words") {
+  auto vec = read_words();
+  ContainerType structure = prepare_word_container(vec);
+
+  BENCHMARK("Type all words with subtrie_iterator()") {
+    std::size_t found = 0;
+    for (auto &p : vec) {
+      std::string_view word = p.first;
+      for (std::size_t len = 1; len <= word.size(); len++) {
+        found += structure.subtrie_iterator(word, len) != structure.end();
+        found += structure.has_key(word.substr(0, len));
+      }
+    }
+    return found;
+  };
+  BENCHMARK("Type all words with a Cursor") {
+    std::size_t found = 0;
+    for (auto &p : vec) {
+      auto cursor = structure.cursor();
+      for (char symbol : p.first) {
+        found += cursor.descend(symbol);
+        found += cursor.has_value();
+      }
+    }
+    return found;
+  };
+}
+#endif
+
+#if BM_TRIE
+TEST_CASE("Finger search") {
+  auto sorted = read_words();
+  std::sort(sorted.begin(), sorted.end());
+  auto shuffled = sorted;
+  std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(42));
+  ContainerType structure = prepare_word_container(sorted);
+
+  auto query_all = [&](std::vector<std::pair<std::string, std::size_t>> &v) {
+    std::size_t sum = 0;
+    for (auto &p : v) {
+      sum += *structure.at(p.first);
+    }
+    return sum;
+  };
+  auto query_all_with_finger =
+      [&](std::vector<std::pair<std::string, std::size_t>> &v) {
+        ContainerType::Finger finger;
+        std::size_t sum = 0;
+        for (auto &p : v) {
+          sum += *structure.at(p.first, finger);
+        }
+        return sum;
+      };
+
+  BENCHMARK("Query words in sorted order") { return query_all(sorted); };
+  BENCHMARK("Query words in sorted order with a finger") {
+    return query_all_with_finger(sorted);
+  };
+  BENCHMARK("Query words in random order") { return query_all(shuffled); };
+  BENCHMARK("Query words in random order with a finger") {
+    return query_all_with_finger(shuffled);
+  };
+}
+#endif
+
+// UnorderedMapStorage does not enumerate children in order.
+#if !BM_UNORDERED_MAP && !BM_GNU_TRIE && !BM_ARRAY_CUSTOM && !BM_CRITBIT
+TEST_CASE("Range scans") {
+  auto vec = read_words();
+  ContainerType structure = prepare_word_container(vec);
+  // 10000 ranges of about 100 words each
+  std::sort(vec.begin(), vec.end());
+  std::vector<std::pair<std::string, std::string>> ranges{};
+  for (std::size_t i = 0; i + 100 < vec.size(); i += vec.size() / 10000) {
+    ranges.emplace_back(vec[i].first, vec[i + 100].first);
+  }
+
+  BENCHMARK("Sum word lengths in ranges") {
+    std::size_t sum = 0;
+    for (auto &range : ranges) {
+#if BM_STD_MAP
+      auto last = structure.lower_bound(range.second);
+      for (auto it = structure.lower_bound(range.first); it != last; ++it) {
+        sum += it->second;
+      }
+#else
+      auto trie_range = structure.range(range.first, range.second);
+      for (auto it = trie_range.begin(); it != trie_range.end(); ++it) {
+        sum += it.value();
+      }
+#endif
+    }
+    return sum;
+  };
+  BENCHMARK("Find lower bounds of words") {
+    std::size_t sum = 0;
+    for (auto &range : ranges) {
+#if BM_STD_MAP
+      sum += structure.lower_bound(range.first)->second;
+#else
+      sum += structure.lower_bound(range.first).value();
+#endif
+    }
+    return sum;
+  };
+}
+#endif
+
+// Lists all words starting with a prefix in pages of 100 words, as a server
+// answering paginated requests would: every page is a new request that only
+// knows where the previous page ended.
+#if BM_TRIE && !BM_UNORDERED_MAP && !BM_ARRAY_CUSTOM
+TEST_CASE("Paginated scans") {
+  auto vec = read_words();
+  ContainerType structure = prepare_word_container(vec);
+  const std::string prefix = "s";
+  const std::size_t page_size = 100;
+
+  BENCHMARK("Page through prefix with continuation keys") {
+    std::size_t sum = 0;
+    std::optional<std::string> after_key{};
+    do {
+      auto page = structure.scan(prefix, after_key, page_size);
+      for (auto &entry : page.entries) {
+        sum += *entry.second;
+      }
+      after_key = std::move(page.continuation);
+    } while (after_key);
+    return sum;
+  };
+  BENCHMARK("Page through prefix by skipping earlier pages") {
+    std::size_t sum = 0;
+    for (std::size_t skip = 0;; skip += page_size) {
+      auto it = structure.subtrie_iterator(prefix);
+      std::size_t i = 0;
+      for (; i != skip && it != structure.end(); i++) {
+        ++it;
+      }
+      for (i = 0; i != page_size && it != structure.end(); i++, ++it) {
+        sum += it.value();
+      }
+      if (it == structure.end()) {
+        break;
+      }
+    }
+    return sum;
+  };
+}
+#endif
+
+// The bits of an IPv4 address that are not part of a prefix of the given
+// length.
+std::uint32_t host_bits(std::uint8_t length) {
+  return length == 0 ? ~std::uint32_t{0}
+                     : ~(~std::uint32_t{0} << (32 - length));
+}
+
+// A synthetic IPv4 route table: random prefixes, most of them /24s.
+std::vector<BitPrefix<std::uint32_t>> make_routes(std::size_t count,
+                                                  std::mt19937 &rng) {
+  std::vector<BitPrefix<std::uint32_t>> routes{};
+  std::uniform_int_distribution<std::uint32_t> bits{};
+  std::discrete_distribution<int> length_class({60, 30, 10});
+  for (std::size_t i = 0; i < count; i++) {
+    int cls = length_class(rng);
+    std::uint8_t length = cls == 0   ? 24
+                          : cls == 1 ? 16 + bits(rng) % 8
+                                     : 8 + bits(rng) % 8;
+    routes.push_back({bits(rng) & ~host_bits(length), length});
+  }
+  return routes;
+}
+
+#if BM_DEFAULT
+TEST_CASE("Longest prefix match") {
+  using Route = BitPrefix<std::uint32_t>;
+  std::mt19937 rng(42);
+  auto routes = make_routes(200000, rng);
+  Trie<Route, std::uint32_t, BitPrefixConverter<std::uint32_t>,
+       ArrayStorage<Route, bool, std::uint32_t, 2>>
+      table;
+  for (std::size_t i = 0; i < routes.size(); i++) {
+    table.insert(routes[i], i);
+  }
+  std::vector<Route> addresses{};
+  std::uniform_int_distribution<std::uint32_t> bits{};
+  for (std::size_t i = 0; i < 1000000; i++) {
+    Route &route = routes[bits(rng) % routes.size()];
+    std::uint32_t host = bits(rng) & host_bits(route.length);
+    addresses.push_back({route.bits | host, 32});
+  }
+
+  BENCHMARK("Route addresses with longest_prefix_match()") {
+    std::uint64_t sum = 0;
+    for (Route &address : addresses) {
+      sum += table.longest_prefix_match(address)->second;
+    }
+    return sum;
+  };
+  BENCHMARK("Route addresses with has_key() on shrinking prefixes") {
+    std::uint64_t sum = 0;
+    for (Route &address : addresses) {
+      for (int length = 32; length >= 0; length--) {
+        std::uint8_t prefix_length = static_cast<std::uint8_t>(length);
+        Route prefix{address.bits & ~host_bits(prefix_length), prefix_length};
+        if (table.has_key(prefix)) {
+          sum += *table.at(prefix);
+          break;
+        }
+      }
+    }
+    return sum;
+  };
+}
+#endif
+
+#if BM_DEFAULT
+TEST_CASE("Forwarding table") {
+  // A table of the size of a full BGP table, plus a few longer routes.
+  std::mt19937 rng(42);
+  auto routes = make_routes(900000, rng);
+  std::uniform_int_distribution<std::uint32_t> bits{};
+  for (std::size_t i = 0; i < 20000; i++) {
+    std::uint8_t length = 25 + bits(rng) % 8;
+    routes.push_back({bits(rng) & ~host_bits(length), length});
+  }
+  Trie<Ipv4Route, std::uint32_t, BitPrefixConverter<std::uint32_t>,
+       ArrayStorage<Ipv4Route, bool, std::uint32_t, 2>>
+      table;
+  for (std::size_t i = 0; i < routes.size(); i++) {
+    table.insert(routes[i], i);
+  }
+  std::vector<std::uint32_t> addresses(10000000);
+  for (auto &address : addresses) {
+    Ipv4Route &route = routes[bits(rng) % routes.size()];
+    address = route.bits | (bits(rng) & host_bits(route.length));
+  }
+
+  BENCHMARK("Build forwarding table") { return Ipv4Fib<std::uint32_t>(table); };
+
+  AtomicFib<std::uint32_t> fib(
+      std::make_shared<const Ipv4Fib<std::uint32_t>>(table));
+  BENCHMARK("Look up 10M addresses in the forwarding table") {
+    auto snapshot = fib.load();
+    std::uint64_t sum = 0;
+    for (std::uint32_t address : addresses) {
+      sum += *snapshot->lookup(address);
+    }
+    return sum;
+  };
+  BENCHMARK("Look up 1M addresses in the trie") {
+    std::uint64_t sum = 0;
+    for (std::size_t i = 0; i < 1000000; i++) {
+      sum += table.longest_prefix_match(Ipv4Route{addresses[i], 32})->second;
+    }
+    return sum;
+  };
+}
+#endif
+
+#if BM_DEFAULT
+// Random keys share almost no prefixes beyond the first few symbols, so a trie
+// of random integers has several nodes per key. 1M keys keep the tries of
+// this test case within a few GB.
+template <typename Container>
+std::size_t insert_and_query(const std::vector<std::uint64_t> &keys) {
+  Container container;
+  for (std::size_t i = 0; i < keys.size(); i++) {
+    container[keys[i]] = i;
+  }
+  std::size_t sum = 0;
+  for (std::uint64_t key : keys) {
+    if constexpr (requires { container.at(key).value(); }) {
+      sum += container.at(key).value();
+    } else {
+      sum += container.find(key)->second;
+    }
+  }
+  return sum;
+}
+
+TEST_CASE("Integer keys") {
+  std::vector<std::uint64_t> keys(1000000);
+  std::mt19937_64 rng(42);
+  for (auto &key : keys) {
+    key = rng();
+  }
+  using Stride8 = IntStrideConverter<std::uint64_t, 8>;
+  using Stride16 = IntStrideConverter<std::uint64_t, 16>;
+
+  BENCHMARK("Insert and query 1M keys, stride 8, HybridStorage") {
+    return insert_and_query<Trie<
+        std::uint64_t, std::size_t, Stride8,
+        HybridStorage<std::uint64_t, std::uint8_t, std::size_t, 256>>>(keys);
+  };
+  BENCHMARK("Insert and query 1M keys, stride 16, MapStorage") {
+    return insert_and_query<Trie<std::uint64_t, std::size_t, Stride16>>(keys);
+  };
+  BENCHMARK("Insert and query 1M keys, std::map") {
+    return insert_and_query<std::map<std::uint64_t, std::size_t>>(keys);
+  };
+  BENCHMARK("Insert and query 1M keys, std::unordered_map") {
+    return insert_and_query<std::unordered_map<std::uint64_t, std::size_t>>(
+        keys);
+  };
+}
+#endif
+
+#if BM_DEFAULT
+TEST_CASE("Bitwise integer keys") {
+  std::vector<std::uint32_t> keys(1000000);
+  std::mt19937 rng(42);
+  for (auto &key : keys) {
+    key = rng();
+  }
+
+  BENCHMARK("Insert and query 1M keys, IntBitwiseConverter trie") {
+    Trie<int, std::size_t, IntBitwiseConverter,
+         ArrayStorage<int, bool, std::size_t, 2>>
+        trie;
+    for (std::size_t i = 0; i < keys.size(); i++) {
+      trie.insert(static_cast<int>(keys[i]), i);
+    }
+    std::size_t sum = 0;
+    for (std::uint32_t key : keys) {
+      sum += *trie.at(static_cast<int>(key));
+    }
+    return sum;
+  };
+  BENCHMARK("Insert and query 1M keys, crit-bit tree") {
+    CritBitTree<std::uint32_t, std::size_t,
+                IntStrideConverter<std::uint32_t, 8>>
+        tree;
+    for (std::size_t i = 0; i < keys.size(); i++) {
+      tree.insert(keys[i], i);
+    }
+    std::size_t sum = 0;
+    for (std::uint32_t key : keys) {
+      sum += *tree.at(key);
+    }
+    return sum;
+  };
+}
+#endif
+
+#if BM_DEFAULT
+TEST_CASE("Multi-pattern search") {
+  auto words = read_words();
+  std::mt19937 rng(42);
+  std::shuffle(words.begin(), words.end(), rng);
+  Trie<std::string, std::size_t> patterns;
+  for (std::size_t i = 0; i < 100000; i++) {
+    patterns.insert(words[i].first, i);
+  }
+  // 64 MiB of text: random words, some of them patterns, separated by spaces
+  std::string text;
+  std::uniform_int_distribution<std::size_t> word{0, words.size() - 1};
+  while (text.size() < (std::size_t{1} << 26)) {
+    text += words[word(rng)].first;
+    text += ' ';
+  }
+
+  // about 410k states times 53 classes
+  std::size_t max_dense_entries = std::size_t{1} << 25;
+  AhoCorasick<std::size_t> dense(patterns, max_dense_entries);
+  AhoCorasick<std::size_t> sparse(patterns, 0);
+  REQUIRE(dense.is_dense());
+
+  BENCHMARK("Build automaton of 100k patterns, dense") {
+    return AhoCorasick<std::size_t>(patterns, max_dense_entries);
+  };
+  BENCHMARK("Scan 64 MiB for 100k patterns, dense") {
+    std::size_t sum = 0;
+    dense.scan(text, [&](std::size_t, std::size_t length, std::size_t) {
+      sum += length;
+    });
+    return sum;
+  };
+  BENCHMARK("Scan 64 MiB for 100k patterns, sparse") {
+    std::size_t sum = 0;
+    sparse.scan(text, [&](std::size_t, std::size_t length, std::size_t) {
+      sum += length;
+    });
+    return sum;
+  };
+}
+#endif
+
+#if BM_DEFAULT
+// Autocomplete: the 10 most frequent words starting with a prefix, with
+// Zipf-distributed frequencies.
+TEST_CASE("Top-k autocomplete") {
+  auto vec = read_words();
+  std::mt19937 rng(42);
+  std::shuffle(vec.begin(), vec.end(), rng);
+  // the word of rank r (counting from 1) has frequency 10^9 / r
+  Trie<std::string, Aggregated<std::uint64_t, MaxOf<std::uint64_t>>> scored;
+  Trie<std::string, std::uint64_t> plain;
+  for (std::size_t i = 0; i < vec.size(); i++) {
+    scored.insert(vec[i].first, 1000000000 / (i + 1));
+    plain.insert(vec[i].first, 1000000000 / (i + 1));
+  }
+  std::vector<std::string> prefixes;
+  for (char c = 'a'; c <= 'z'; c++) {
+    prefixes.push_back(std::string(1, c));
+  }
+  std::uniform_int_distribution<std::size_t> word{0, vec.size() - 1};
+  while (prefixes.size() < 1000) {
+    std::string &w = vec[word(rng)].first;
+    prefixes.push_back(w.substr(0, std::min<std::size_t>(3, w.size())));
+  }
+
+  BENCHMARK("Top 10 for 1000 prefixes, best-first search") {
+    std::uint64_t sum = 0;
+    for (auto &prefix : prefixes) {
+      for (auto &match : scored.top_k(prefix, 10)) {
+        sum += *match.second;
+      }
+    }
+    return sum;
+  };
+  BENCHMARK("Top 10 for 1000 prefixes, subtrie_iterator and heap") {
+    std::uint64_t sum = 0;
+    std::vector<std::pair<std::uint64_t, std::string>> candidates;
+    for (auto &prefix : prefixes) {
+      candidates.clear();
+      for (auto it = plain.subtrie_iterator(prefix); it != plain.end(); ++it) {
+        candidates.emplace_back(it.value(), it.key());
+      }
+      std::size_t k = std::min<std::size_t>(10, candidates.size());
+      std::partial_sort(candidates.begin(), candidates.begin() + k,
+                        candidates.end(), std::greater<>());
+      for (std::size_t i = 0; i < k; i++) {
+        sum += candidates[i].first;
+      }
+    }
+    return sum;
+  };
+  BENCHMARK("Update 1000 scores, then top 10 for 1000 prefixes") {
+    std::uint64_t sum = 0;
+    for (std::size_t i = 0; i < 1000; i++) {
+      *scored[vec[word(rng)].first] += 1;
+    }
+    for (auto &prefix : prefixes) {
+      for (auto &match : scored.top_k(prefix, 10)) {
+        sum += *match.second;
+      }
+    }
+    return sum;
+  };
+}
+#endif
+
+#if BM_DEFAULT
+TEST_CASE("Counting keys") {
+  auto vec = read_words();
+  Trie<std::string, Aggregated<std::size_t, CountOf<std::size_t>>> counted;
+  Trie<std::string, std::size_t> plain;
+  for (auto &p : vec) {
+    counted.insert(p.first, p.second);
+    plain.insert(p.first, p.second);
+  }
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<std::size_t> word{0, vec.size() - 1};
+  std::vector<std::string> prefixes;
+  for (char c = 'a'; c <= 'z'; c++) {
+    prefixes.push_back(std::string(1, c));
+  }
+  while (prefixes.size() < 1000) {
+    std::string &w = vec[word(rng)].first;
+    prefixes.push_back(w.substr(0, std::min<std::size_t>(3, w.size())));
+  }
+  std::vector<std::size_t> positions(10);
+  for (auto &position : positions) {
+    position = word(rng);
+  }
+  counted.count_prefix("");
+
+  BENCHMARK("Count keys under 1000 prefixes with count_prefix()") {
+    std::size_t sum = 0;
+    for (auto &prefix : prefixes) {
+      sum += counted.count_prefix(prefix);
+    }
+    return sum;
+  };
+  BENCHMARK("Count keys under 1000 prefixes with subtrie_iterator()") {
+    std::size_t sum = 0;
+    for (auto &prefix : prefixes) {
+      for (auto it = plain.subtrie_iterator(prefix); it != plain.end(); ++it) {
+        sum++;
+      }
+    }
+    return sum;
+  };
+  BENCHMARK("Select 10 keys by position with select()") {
+    std::size_t sum = 0;
+    for (std::size_t position : positions) {
+      sum += counted.select(position).value();
+    }
+    return sum;
+  };
+  BENCHMARK("Select 10 keys by position by iterating") {
+    std::size_t sum = 0;
+    for (std::size_t position : positions) {
+      auto it = plain.ordered_begin();
+      for (std::size_t i = 0; i < position; i++) {
+        ++it;
+      }
+      sum += it.value();
+    }
+    return sum;
+  };
+  BENCHMARK("Rank 1000 prefixes with rank()") {
+    std::size_t sum = 0;
+    for (auto &prefix : prefixes) {
+      sum += counted.rank(prefix);
+    }
+    return sum;
+  };
+}
+#endif
+
+#if BM_DEFAULT
+TEST_CASE("Random sampling") {
+  auto vec = read_words();
+  Trie<std::string, Aggregated<std::size_t, CountOf<std::size_t>>> counted;
+  Trie<std::string, std::size_t> plain;
+  for (auto &p : vec) {
+    counted.insert(p.first, p.second);
+    plain.insert(p.first, p.second);
+  }
+  counted.count_prefix("");
+  std::mt19937 rng(42);
+  const std::string prefix = "s";
+
+  BENCHMARK("Draw 100 keys with sample()") {
+    std::size_t sum = 0;
+    for (int i = 0; i != 100; i++) {
+      sum += *counted.sample(prefix, rng)->second;
+    }
+    return sum;
+  };
+  BENCHMARK("Draw 100 keys by collecting the subtrie") {
+    std::size_t sum = 0;
+    for (int i = 0; i != 100; i++) {
+      std::vector<std::size_t> subtrie{};
+      for (auto it = plain.subtrie_iterator(prefix); it != plain.end(); ++it) {
+        subtrie.push_back(it.value());
+      }
+      sum += subtrie[std::uniform_int_distribution<std::size_t>(
+          0, subtrie.size() - 1)(rng)];
+    }
+    return sum;
+  };
+  BENCHMARK("Draw 1000 distinct keys with sample()") {
+    std::size_t sum = 0;
+    for (auto &entry : counted.sample(prefix, 1000, rng)) {
+      sum += *entry.second;
+    }
+    return sum;
+  };
+  BENCHMARK("Draw 1000 distinct keys by collecting the subtrie") {
+    std::vector<std::size_t> subtrie{};
+    for (auto it = plain.subtrie_iterator(prefix); it != plain.end(); ++it) {
+      subtrie.push_back(it.value());
+    }
+    std::vector<std::size_t> drawn{};
+    std::sample(subtrie.begin(), subtrie.end(), std::back_inserter(drawn),
+                1000, rng);
+    std::size_t sum = 0;
+    for (std::size_t value : drawn) {
+      sum += value;
+    }
+    return sum;
+  };
+}
+#endif
+
+#if BM_DEFAULT
+// The sum of the values (word lengths) of all keys under a prefix.
+TEST_CASE("Prefix aggregates") {
+  auto vec = read_words();
+  using SumTrie =
+      Trie<std::string, Aggregated<std::size_t, SumOf<std::size_t>>>;
+  SumTrie summed;
+  Trie<std::string, std::size_t> plain;
+  for (auto &p : vec) {
+    summed.insert(p.first, p.second);
+    plain.insert(p.first, p.second);
+  }
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<std::size_t> word{0, vec.size() - 1};
+  std::vector<std::string> prefixes;
+  while (prefixes.size() < 1000) {
+    std::string &w = vec[word(rng)].first;
+    prefixes.push_back(w.substr(0, std::min<std::size_t>(2, w.size())));
+  }
+  summed.aggregate("");
+
+  BENCHMARK("Sum under 1000 prefixes with aggregate()") {
+    std::size_t sum = 0;
+    for (auto &prefix : prefixes) {
+      sum += summed.aggregate(prefix);
+    }
+    return sum;
+  };
+  BENCHMARK("Sum under 1000 prefixes with subtrie_iterator()") {
+    std::size_t sum = 0;
+    for (auto &prefix : prefixes) {
+      for (auto it = plain.subtrie_iterator(prefix); it != plain.end(); ++it) {
+        sum += it.value();
+      }
+    }
+    return sum;
+  };
+  BENCHMARK("Update 1000 values, then sum under 1000 prefixes") {
+    std::size_t sum = 0;
+    for (std::size_t i = 0; i < 1000; i++) {
+      *summed[vec[word(rng)].first] += 1;
+    }
+    for (auto &prefix : prefixes) {
+      sum += summed.aggregate(prefix);
+    }
+    return sum;
+  };
+  BENCHMARK("Insert all words, Aggregated values") {
+    SumTrie trie;
+    for (auto &p : vec) {
+      trie.insert(p.first, p.second);
+    }
+    return trie.aggregate("");
+  };
+  BENCHMARK("Insert all words, plain values") {
+    Trie<std::string, std::size_t> trie;
+    for (auto &p : vec) {
+      trie.insert(p.first, p.second);
+    }
+    return trie.has_key("");
+  };
+}
+#endif
+
+// Combines 16 tries built from consecutive slices of the word list, e.g.
+// tries that were filled by different threads. merge() and difference()
+// consume their input, so those benchmarks work on copies; the time of
+// making (and destroying) the copies alone is measured as well.
+#if BM_TRIE
+TEST_CASE("Merging tries") {
+  auto vec = read_words();
+  const std::size_t part_count = 16;
+  std::vector<ContainerType> parts{};
+  for (std::size_t i = 0; i != part_count; i++) {
+    std::vector<std::pair<std::string, std::size_t>> slice(
+        vec.begin() + i * vec.size() / part_count,
+        vec.begin() + (i + 1) * vec.size() / part_count);
+    parts.push_back(prepare_word_container(slice));
+  }
+  auto add = [](std::size_t x, std::size_t y) { return x + y; };
+
+  BENCHMARK("Copy 16 tries") {
+    std::vector<ContainerType> copies = parts;
+    return copies.size();
+  };
+  BENCHMARK("Copy 16 tries and merge them with merge()") {
+    std::vector<ContainerType> copies = parts;
+    ContainerType merged{};
+    for (ContainerType &copy : copies) {
+      merged.merge(std::move(copy), add);
+    }
+    return merged;
+  };
+  BENCHMARK("Merge 16 tries by inserting") {
+    ContainerType merged{};
+    for (ContainerType &part : parts) {
+      for (auto it = part.begin(); it != part.end(); ++it) {
+        merged.insert(it.key(), it.value());
+      }
+    }
+    return merged;
+  };
+
+  // every second word minus every third word
+  ContainerType evens{}, thirds{};
+  for (std::size_t i = 0; i < vec.size(); i++) {
+    if (i % 2 == 0) {
+      evens.insert(vec[i].first, vec[i].second);
+    }
+    if (i % 3 == 0) {
+      thirds.insert(vec[i].first, vec[i].second);
+    }
+  }
+  BENCHMARK("Copy a trie") { return ContainerType(evens); };
+  BENCHMARK("Copy a trie and subtract another with difference()") {
+    return difference(ContainerType(evens), thirds);
+  };
+  BENCHMARK("Subtract a trie by inserting") {
+    ContainerType rest{};
+    for (auto it = evens.begin(); it != evens.end(); ++it) {
+      if (!thirds.has_key(it.key())) {
+        rest.insert(it.key(), it.value());
+      }
+    }
+    return rest;
+  };
+}
+#endif
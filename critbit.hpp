@@ -0,0 +1,388 @@
+// Copyright (C) 2020 Juri Dispan
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+// Place, Suite 330, Boston, MA 02111-1307 USA
+
+#ifndef CRITBIT_HPP
+#define CRITBIT_HPP
+
+#include "trie.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A crit-bit tree (a binary PATRICIA trie): Instead of one node per symbol,
+// there is one internal node per bit position at which the keys below it
+// first differ (the critical bit), and one leaf per key that stores the key
+// and its value. So each key costs one leaf and one internal node of two
+// pointers and two 32-bit integers, no matter how long the key is, and a
+// lookup visits one internal node per distinct critical bit on its path, plus
+// one full key comparison at the leaf.
+// Keys are read with a Converter like in Trie. Symbols may have up to 16 bits,
+// e.g. chars of strings or the bytes of an integer read by
+// IntStrideConverter<T, 8>. Keys of different lengths are supported.
+// The API follows Trie, except that iteration is in key order (shorter keys
+// before the longer keys they are a prefix of).
+template <typename KeyType, typename ValueType,
+          ConverterType<KeyType> Converter = DummyConverter<KeyType>>
+requires(sizeof(typename Converter::KeyContent) <= 2) class CritBitTree {
+private:
+  using KeyContent = typename Converter::KeyContent;
+
+  struct Leaf {
+    KeyType key;
+    std::optional<ValueType> value;
+  };
+
+  struct Internal;
+
+  // A tagged pointer to either a Leaf or an Internal node. Internal nodes
+  // have the lowest bit set, which is always free because operator new
+  // returns memory aligned for any fundamental type.
+  class Ref {
+  public:
+    Ref() : bits(0) {}
+    Ref(Leaf *leaf) : bits(reinterpret_cast<std::uintptr_t>(leaf)) {}
+    Ref(Internal *node) : bits(reinterpret_cast<std::uintptr_t>(node) | 1) {}
+
+    bool empty() const { return bits == 0; }
+    bool is_internal() const { return bits & 1; }
+    Leaf *leaf() const { return reinterpret_cast<Leaf *>(bits); }
+    Internal *internal() const {
+      return reinterpret_cast<Internal *>(bits & ~std::uintptr_t{1});
+    }
+
+  private:
+    std::uintptr_t bits;
+  };
+
+  struct Internal {
+    Ref child[2];
+    // The index of the critical symbol and the critical bit within it.
+    std::uint32_t index;
+    std::uint32_t mask;
+  };
+
+public:
+  class Iterator;
+
+  CritBitTree() : root() {}
+
+  CritBitTree(const CritBitTree &other) : root(copy(other.root)) {}
+
+  CritBitTree(CritBitTree &&other) : root() { swap(*this, other); }
+
+  ~CritBitTree() { destroy(root); }
+
+  friend void swap(CritBitTree &t1, CritBitTree &t2) {
+    std::swap(t1.root, t2.root);
+  }
+
+  CritBitTree &operator=(const CritBitTree &other) {
+    return *this = CritBitTree(other);
+  }
+
+  CritBitTree &operator=(CritBitTree &&other) {
+    swap(*this, other);
+    return *this;
+  }
+
+  // Like Trie::insert, this returns the value previously associated with the
+  // key, if any.
+  std::optional<ValueType> insert(const KeyType &key, ValueType to_insert) {
+    std::optional to_insert_o(std::move(to_insert));
+    leaf_for(key)->value.swap(to_insert_o);
+    return to_insert_o;
+  }
+
+  std::optional<ValueType> at(const KeyType &key) const {
+    Leaf *leaf = find_leaf(key);
+    return leaf ? leaf->value : std::nullopt;
+  }
+
+  std::optional<ValueType> &operator[](const KeyType &key) {
+    return leaf_for(key)->value;
+  }
+
+  bool has_key(const KeyType &key) const {
+    Leaf *leaf = find_leaf(key);
+    return leaf && leaf->value.has_value();
+  }
+
+  // Removes a key and its value. Returns the value, if there was one.
+  std::optional<ValueType> erase(const KeyType &key) {
+    if (root.empty()) {
+      return std::nullopt;
+    }
+    Ref *where = &root;
+    Ref *where_parent = nullptr;
+    Internal *parent = nullptr;
+    int direction = 0;
+    while (where->is_internal()) {
+      where_parent = where;
+      parent = where->internal();
+      direction = direction_of(parent, key);
+      where = &parent->child[direction];
+    }
+    Leaf *leaf = where->leaf();
+    if (!equal(leaf->key, key)) {
+      return std::nullopt;
+    }
+    std::optional<ValueType> erased = std::move(leaf->value);
+    delete leaf;
+    if (!parent) {
+      root = Ref();
+    } else {
+      *where_parent = parent->child[1 - direction];
+      delete parent;
+    }
+    return erased;
+  }
+
+  Iterator begin() const { return Iterator(root); }
+
+  Iterator end() const { return Iterator(); }
+
+  // Enumerates all keys starting with the given prefix in key order.
+  Iterator subtrie_iterator(const KeyType &prefix) const {
+    std::size_t prefix_size = Converter::size(prefix);
+    Ref current = root;
+    while (current.is_internal() &&
+           current.internal()->index < prefix_size) {
+      Internal *node = current.internal();
+      current = node->child[direction_of(node, prefix)];
+    }
+    if (current.empty()) {
+      return end();
+    }
+    // All keys below current agree on the symbols before the index of
+    // current's critical bit, so it suffices to check one of them.
+    Ref leftmost = current;
+    while (leftmost.is_internal()) {
+      leftmost = leftmost.internal()->child[0];
+    }
+    const KeyType &key = leftmost.leaf()->key;
+    if (Converter::size(key) < prefix_size) {
+      return end();
+    }
+    for (std::size_t pos_in_key = 0; pos_in_key != prefix_size; pos_in_key++) {
+      if (Converter::get_at_index(key, pos_in_key) !=
+          Converter::get_at_index(prefix, pos_in_key)) {
+        return end();
+      }
+    }
+    return Iterator(current);
+  }
+
+  // Enumerates the keys in key order. Only keys with values are visited.
+  class Iterator {
+    friend class CritBitTree<KeyType, ValueType, Converter>;
+
+  public:
+    std::pair<KeyType, ValueType> operator*() const {
+      assert(leaf);
+      return std::pair<KeyType, ValueType>(leaf->key, *leaf->value);
+    }
+
+    KeyType key() const {
+      assert(leaf);
+      return leaf->key;
+    }
+
+    // A value can be modified via iterator.
+    ValueType &value() const {
+      assert(leaf);
+      return *leaf->value;
+    }
+
+    Iterator &operator++() {
+      assert(leaf);
+      advance();
+      return *this;
+    }
+
+    bool operator==(const Iterator &other) const { return leaf == other.leaf; }
+
+    bool operator!=(const Iterator &other) const { return !(*this == other); }
+
+  private:
+    Iterator() : leaf(nullptr), pending() {}
+
+    Iterator(Ref subroot) : leaf(nullptr), pending() {
+      if (!subroot.empty()) {
+        descend(subroot);
+        if (!leaf->value) {
+          advance();
+        }
+      }
+    }
+
+    // Goes to the leftmost leaf below ref, remembering the internal nodes
+    // whose right subtries are still to be visited.
+    void descend(Ref ref) {
+      while (ref.is_internal()) {
+        pending.push_back(ref.internal());
+        ref = ref.internal()->child[0];
+      }
+      leaf = ref.leaf();
+    }
+
+    void advance() {
+      do {
+        if (pending.empty()) {
+          leaf = nullptr;
+          return;
+        }
+        Internal *node = pending.back();
+        pending.pop_back();
+        descend(node->child[1]);
+      } while (!leaf->value);
+    }
+
+    Leaf *leaf;
+    std::vector<Internal *> pending;
+  };
+
+private:
+  Ref root;
+
+  // The symbols of keys are shifted by one, so that the end of a key (0)
+  // differs from every symbol. Thus no key is a prefix of another one in the
+  // eyes of the tree.
+  static std::uint32_t symbol_at(const KeyType &key, std::size_t ind) {
+    using Unsigned = std::make_unsigned_t<std::conditional_t<
+        std::is_same_v<KeyContent, bool>, unsigned char, KeyContent>>;
+    return ind < Converter::size(key)
+               ? static_cast<std::uint32_t>(static_cast<Unsigned>(
+                     Converter::get_at_index(key, ind))) +
+                     1
+               : 0;
+  }
+
+  static int direction_of(const Internal *node, const KeyType &key) {
+    return (symbol_at(key, node->index) & node->mask) ? 1 : 0;
+  }
+
+  static bool equal(const KeyType &k1, const KeyType &k2) {
+    std::size_t size = Converter::size(k1);
+    if (size != Converter::size(k2)) {
+      return false;
+    }
+    for (std::size_t pos_in_key = 0; pos_in_key != size; pos_in_key++) {
+      if (Converter::get_at_index(k1, pos_in_key) !=
+          Converter::get_at_index(k2, pos_in_key)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Returns the leaf of the key or nullptr if there is none.
+  Leaf *find_leaf(const KeyType &key) const {
+    if (root.empty()) {
+      return nullptr;
+    }
+    Ref current = root;
+    while (current.is_internal()) {
+      Internal *node = current.internal();
+      current = node->child[direction_of(node, key)];
+    }
+    return equal(current.leaf()->key, key) ? current.leaf() : nullptr;
+  }
+
+  // Returns the leaf of the key, inserting one without a value if there is
+  // none.
+  Leaf *leaf_for(const KeyType &key) {
+    if (root.empty()) {
+      Leaf *leaf = new Leaf{key, std::nullopt};
+      root = Ref(leaf);
+      return leaf;
+    }
+
+    // The leaf that the key's bits lead to shares the longest prefix with the
+    // key among all keys in the tree.
+    Ref current = root;
+    while (current.is_internal()) {
+      Internal *node = current.internal();
+      current = node->child[direction_of(node, key)];
+    }
+    Leaf *closest = current.leaf();
+    std::size_t index = 0;
+    std::size_t size = std::max(Converter::size(key),
+                                Converter::size(closest->key));
+    while (index != size &&
+           symbol_at(key, index) == symbol_at(closest->key, index)) {
+      index++;
+    }
+    if (index == size) {
+      return closest;
+    }
+    std::uint32_t differing =
+        symbol_at(key, index) ^ symbol_at(closest->key, index);
+    std::uint32_t mask = std::bit_floor(differing);
+    int direction = (symbol_at(key, index) & mask) ? 1 : 0;
+
+    // Internal nodes on a path are ordered by their critical bit; insert the
+    // new one where it belongs.
+    Ref *where = &root;
+    while (where->is_internal()) {
+      Internal *node = where->internal();
+      if (node->index > index || (node->index == index && node->mask < mask)) {
+        break;
+      }
+      where = &node->child[direction_of(node, key)];
+    }
+    Leaf *leaf = new Leaf{key, std::nullopt};
+    Internal *node =
+        new Internal{{}, static_cast<std::uint32_t>(index), mask};
+    node->child[direction] = Ref(leaf);
+    node->child[1 - direction] = *where;
+    *where = Ref(node);
+    return leaf;
+  }
+
+  static Ref copy(Ref ref) {
+    if (ref.empty()) {
+      return ref;
+    }
+    if (!ref.is_internal()) {
+      return Ref(new Leaf(*ref.leaf()));
+    }
+    Internal *node = ref.internal();
+    return Ref(new Internal{{copy(node->child[0]), copy(node->child[1])},
+                            node->index,
+                            node->mask});
+  }
+
+  static void destroy(Ref ref) {
+    if (ref.empty()) {
+      return;
+    }
+    if (!ref.is_internal()) {
+      delete ref.leaf();
+      return;
+    }
+    destroy(ref.internal()->child[0]);
+    destroy(ref.internal()->child[1]);
+    delete ref.internal();
+  }
+};
+
+#endif
@@ -0,0 +1,153 @@
+// Copyright (C) 2020 Juri Dispan
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+// Place, Suite 330, Boston, MA 02111-1307 USA
+
+#ifndef IP_FIB_HPP
+#define IP_FIB_HPP
+
+#include "trie.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using Ipv4Route = BitPrefix<std::uint32_t>;
+
+// A read-only IPv4 forwarding table for fast longest-prefix matching, compiled
+// from a trie of routes (DIR-24-8): The first 24 bits of an address index a
+// table with 2^24 entries. Entries of /24 blocks that contain longer routes
+// refer to a group of 256 entries that is indexed by the last 8 bits. So
+// every lookup needs at most two memory accesses.
+// The tables take 64 MiB plus 1 KiB per /24 block with longer routes. Route
+// updates are made to the trie, from which a new Ipv4Fib is built (see
+// AtomicFib).
+template <typename NextHop> class Ipv4Fib {
+public:
+  // Routes can be given by any trie with BitPrefixConverter and a storage that
+  // supports lookups in key order.
+  template <typename Storage, std::size_t root_table_size>
+  explicit Ipv4Fib(const Trie<Ipv4Route, NextHop,
+                              BitPrefixConverter<std::uint32_t>, Storage,
+                              root_table_size> &routes)
+      : tbl24(std::size_t{1} << 24, no_route), tbl8(), next_hops() {
+    // In key order, every route comes before the longer routes it contains,
+    // so the more specific routes simply overwrite the less specific ones.
+    for (auto it = routes.ordered_begin(); it != routes.ordered_end(); ++it) {
+      Ipv4Route route = it.key();
+      assert(next_hops.size() < no_route);
+      std::uint32_t entry = static_cast<std::uint32_t>(next_hops.size());
+      next_hops.push_back(it.value());
+      if (route.length <= 24) {
+        std::size_t count = std::size_t{1} << (24 - route.length);
+        std::size_t first = (route.bits >> 8) & ~(count - 1);
+        for (std::size_t i = first; i != first + count; i++) {
+          // longer routes inside this one come later
+          assert(!(tbl24[i] & extended));
+          tbl24[i] = entry;
+        }
+      } else {
+        std::size_t count = std::size_t{1} << (32 - route.length);
+        std::size_t first =
+            group_of(route.bits >> 8) + ((route.bits & 0xff) & ~(count - 1));
+        std::fill_n(tbl8.begin() + first, count, entry);
+      }
+    }
+  }
+
+  // Returns the next hop of the most specific route for the address, or
+  // nullptr if there is no such route.
+  const NextHop *lookup(std::uint32_t address) const noexcept {
+    std::uint32_t entry = tbl24[address >> 8];
+    if (entry & extended) {
+      entry = tbl8[(std::size_t{entry & ~extended} << 8) | (address & 0xff)];
+    }
+    return entry == no_route ? nullptr : &next_hops[entry];
+  }
+
+private:
+  // Entries are indices into next_hops. Entries of tbl24 with the highest bit
+  // set are indices of groups in tbl8 instead.
+  static constexpr std::uint32_t extended = std::uint32_t{1} << 31;
+  static constexpr std::uint32_t no_route = extended - 1;
+
+  // Returns the first index of the tbl8 group of a /24 block, creating the
+  // group from the block's entry if there is none yet.
+  std::size_t group_of(std::uint32_t block) {
+    if (!(tbl24[block] & extended)) {
+      std::uint32_t group = static_cast<std::uint32_t>(tbl8.size() >> 8);
+      assert(group < no_route);
+      tbl8.resize(tbl8.size() + 256, tbl24[block]);
+      tbl24[block] = group | extended;
+    }
+    return std::size_t{tbl24[block] & ~extended} << 8;
+  }
+
+  std::vector<std::uint32_t> tbl24;
+  std::vector<std::uint32_t> tbl8;
+  std::vector<NextHop> next_hops;
+};
+
+// Holds the Ipv4Fib that is currently in use. Readers load() a snapshot and
+// look up addresses in it for as long as they like; a writer builds a new
+// Ipv4Fib after route updates and publishes it with a single atomic swap, so
+// readers never wait for a rebuild. Snapshots are freed when their last
+// reader is done.
+// Uses std::atomic<std::shared_ptr> where the standard library provides it
+// and a mutex around the shared_ptr otherwise.
+template <typename NextHop> class AtomicFib {
+public:
+  using Snapshot = std::shared_ptr<const Ipv4Fib<NextHop>>;
+
+  explicit AtomicFib(Snapshot fib) : current(std::move(fib)) {}
+
+  Snapshot load() const {
+#ifdef __cpp_lib_atomic_shared_ptr
+    return current.load();
+#else
+    std::lock_guard<std::mutex> lock(mutex);
+    return current;
+#endif
+  }
+
+  // Replaces the current table; returns the previous one.
+  Snapshot exchange(Snapshot fib) {
+#ifdef __cpp_lib_atomic_shared_ptr
+    return current.exchange(std::move(fib));
+#else
+    std::lock_guard<std::mutex> lock(mutex);
+    current.swap(fib);
+    return fib;
+#endif
+  }
+
+  // Builds a new table from the routes and swaps it in.
+  template <typename RouteTrie> void rebuild(const RouteTrie &routes) {
+    exchange(std::make_shared<const Ipv4Fib<NextHop>>(routes));
+  }
+
+private:
+#ifdef __cpp_lib_atomic_shared_ptr
+  std::atomic<Snapshot> current;
+#else
+  mutable std::mutex mutex;
+  Snapshot current;
+#endif
+};
+
+#endif
@@ -15,18 +15,41 @@
 
 #include "catch2/catch.hpp"
 #include "trie.hpp"
+#include "ip_fib.hpp"
+#include "critbit.hpp"
+#include "aho_corasick.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <iostream>
+#include <iterator>
+#include <map>
 #include <optional>
+#include <random>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 #ifdef TEST_USE_ARRAY
 using StringStringTrie =
     Trie<std::string, std::string, DummyConverter<std::string>,
          ArrayStorage<std::string, char, std::string, 256>>;
+using StringSet = TrieSet<std::string, DummyConverter<std::string>,
+                          ArrayStorage<std::string, char, void, 256>>;
+#elif TEST_USE_HYBRID
+// small thresholds so that the tests exercise both representations.
+using StringStringTrie =
+    Trie<std::string, std::string, DummyConverter<std::string>,
+         HybridStorage<std::string, char, std::string, 256, 2, 1>>;
+using StringSet = TrieSet<std::string, DummyConverter<std::string>,
+                          HybridStorage<std::string, char, void, 256, 2, 1>>;
 #else
 using StringStringTrie = Trie<std::string, std::string>;
+using StringSet = TrieSet<std::string>;
 #endif
 
 TEST_CASE("Constructing/copying/moving tries", "[trie constructor]") {
@@ -380,4 +403,1455 @@ TEST_CASE("Using the non-default key-converter", "[trie converter]") {
   ++it2;
   REQUIRE(it2 == trie.end());
 }
+TEST_CASE("Erase elements from the trie", "[trie erase]") {
+  StringStringTrie trie{};
+  trie.insert("A", "A");
+  trie.insert("AB", "AB");
+  trie.insert("ABC", "ABC");
+  trie.insert("B", "B");
+
+  SECTION("Erase existing keys") {
+    REQUIRE(trie.erase("AB") == "AB");
+    REQUIRE_FALSE(trie.has_key("AB"));
+    REQUIRE(trie.at("ABC") == "ABC");
+    REQUIRE(trie.at("A") == "A");
+
+    REQUIRE(trie.erase("ABC") == "ABC");
+    REQUIRE(trie.erase("B") == "B");
+
+    std::vector<std::pair<std::string, std::string>> results{};
+    for (auto x : trie) {
+      results.push_back(x);
+    }
+    REQUIRE(results ==
+            std::vector<std::pair<std::string, std::string>>{{"A", "A"}});
+  }
+
+  SECTION("Erase keys that are not there") {
+    REQUIRE(trie.erase("") == std::optional<std::string>());
+    REQUIRE(trie.erase("ABCD") == std::optional<std::string>());
+    REQUIRE(trie.erase("X") == std::optional<std::string>());
+    REQUIRE(trie.erase("AB") == "AB");
+    REQUIRE(trie.erase("AB") == std::optional<std::string>());
+    REQUIRE(trie.at("ABC") == "ABC");
+  }
+
+  SECTION("Reinsert erased keys") {
+    trie.erase("ABC");
+    trie.erase("AB");
+    REQUIRE(trie.subtrie_iterator("AB") == trie.end());
+    trie["ABC"] = "X";
+    REQUIRE(trie.at("ABC") == "X");
+    REQUIRE_FALSE(trie.has_key("AB"));
+  }
+}
+
+TEST_CASE("Hybrid storage switching representations", "[trie hybrid]") {
+  using HybridTrie = Trie<std::string, int, DummyConverter<std::string>,
+                          HybridStorage<std::string, char, int, 256, 4, 2>>;
+  HybridTrie trie{};
+  const std::string symbols = "fedcba";
+  for (char c : symbols) {
+    trie[std::string(1, c)] = c;
+  }
+
+  auto keys = [&trie] {
+    std::string result;
+    for (auto it = trie.begin(); it != trie.end(); ++it) {
+      result += it.key();
+    }
+    return result;
+  };
+
+  // promoted to the dense representation; order is still by symbol
+  REQUIRE(keys() == "abcdef");
+
+  trie.erase("a");
+  trie.erase("c");
+  trie.erase("e");
+  REQUIRE(keys() == "bdf");
+
+  // demoted to the sparse representation
+  trie.erase("f");
+  REQUIRE(keys() == "bd");
+  REQUIRE(trie.at("b") == 'b');
+  REQUIRE(trie.at("d") == 'd');
+  REQUIRE_FALSE(trie.has_key("f"));
+
+  trie["a"] = 'a';
+  HybridTrie copy(trie);
+  REQUIRE(copy.at("a") == 'a');
+  REQUIRE(copy.at("b") == 'b');
+}
+
+TEST_CASE("Using a root table", "[trie root table]") {
+  using RootTableTrie = Trie<std::string, int, DummyConverter<std::string>,
+                             MapStorage<std::string, char, int>, 256>;
+  std::vector<std::string> keys{"",  "a",   "ab",       "abc",  "b",
+                                "ba", "bcd", "\xff\xfe", "\xffx"};
+  RootTableTrie trie{};
+  Trie<std::string, int> reference{};
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    trie.insert(keys[i], i);
+    reference.insert(keys[i], i);
+  }
+
+  SECTION("Lookups") {
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+      REQUIRE(trie.at(keys[i]) == static_cast<int>(i));
+    }
+    REQUIRE_FALSE(trie.has_key("bc"));
+    REQUIRE_FALSE(trie.has_key("ac"));
+    REQUIRE_FALSE(trie.has_key("abcd"));
+    REQUIRE(trie.subtrie_iterator("xy") == trie.end());
+  }
+
+  SECTION("Iteration order is not affected") {
+    std::vector<std::pair<std::string, int>> results{};
+    std::vector<std::pair<std::string, int>> expected{};
+    for (auto x : trie) {
+      results.push_back(x);
+    }
+    for (auto x : reference) {
+      expected.push_back(x);
+    }
+    REQUIRE(results == expected);
+
+    auto it = trie.subtrie_iterator("ab");
+    REQUIRE(it.key() == "abc");
+    ++it;
+    REQUIRE(it.key() == "ab");
+    ++it;
+    REQUIRE(it == trie.end());
+  }
+
+  SECTION("Erasing and copying") {
+    trie.erase("abc");
+    trie.erase("ab");
+    trie.erase("bcd");
+    REQUIRE_FALSE(trie.has_key("ab"));
+    REQUIRE_FALSE(trie.has_key("abc"));
+    REQUIRE_FALSE(trie.has_key("bcd"));
+
+    trie["abd"] = 42;
+    RootTableTrie copy(trie);
+    trie.erase("abd");
+    REQUIRE_FALSE(trie.has_key("abd"));
+    REQUIRE(copy.at("abd") == 42);
+    REQUIRE(copy.at("ba") == 5);
+    REQUIRE_FALSE(copy.has_key("bcd"));
+  }
+}
+
+TEST_CASE("Compacting a trie", "[trie compact]") {
+  StringStringTrie trie{};
+  const std::vector<std::string> keys{"ABC", "B", "A", "AB", "XYZ", "XY", ""};
+  for (const std::string &key : keys) {
+    trie.insert(key, key + "!");
+  }
+
+  std::vector<std::pair<std::string, std::string>> before{};
+  for (auto x : trie) {
+    before.push_back(x);
+  }
+
+  trie.compact();
+
+  std::vector<std::pair<std::string, std::string>> after{};
+  for (auto x : trie) {
+    after.push_back(x);
+  }
+  REQUIRE(after == before);
+  REQUIRE(trie.at("XY") == "XY!");
+  REQUIRE(trie.at("") == "!");
+  REQUIRE_FALSE(trie.has_key("X"));
+
+  // the compacted trie can still be modified and copied
+  trie["XYW"] = "XYW";
+  trie.erase("ABC");
+  trie.erase("XY");
+  StringStringTrie copy(trie);
+  trie.compact();
+  REQUIRE(copy.at("XYW") == "XYW");
+  REQUIRE(trie.at("XYW") == "XYW");
+  REQUIRE(trie.at("XYZ") == "XYZ!");
+  REQUIRE_FALSE(trie.has_key("ABC"));
+  REQUIRE_FALSE(trie.has_key("XY"));
+}
+
+TEST_CASE("Storing values outside of the nodes", "[trie detached]") {
+  using Value = std::array<int, 64>;
+#ifdef TEST_USE_ARRAY
+  using DetachedTrie =
+      Trie<std::string, DetachedValue<Value>, DummyConverter<std::string>,
+           ArrayStorage<std::string, char, DetachedValue<Value>, 256>>;
+#elif TEST_USE_HYBRID
+  using DetachedTrie =
+      Trie<std::string, DetachedValue<Value>, DummyConverter<std::string>,
+           HybridStorage<std::string, char, DetachedValue<Value>, 256, 2, 1>>;
+#else
+  using DetachedTrie = Trie<std::string, DetachedValue<Value>>;
+#endif
+  static_assert(std::is_same_v<DetachedTrie::MappedType, Value>);
+
+  auto value_of = [](int i) {
+    Value v{};
+    v.fill(i);
+    return v;
+  };
+
+  DetachedTrie trie{};
+  trie.insert("A", value_of(1));
+  trie.insert("AB", value_of(2));
+  trie["B"] = value_of(3);
+
+  REQUIRE(trie.at("A") == value_of(1));
+  REQUIRE(trie.at("AB") == value_of(2));
+  REQUIRE(trie.at("B") == value_of(3));
+  REQUIRE(trie.at("C") == std::optional<Value>());
+  REQUIRE(trie.insert("A", value_of(4)) == value_of(1));
+
+  std::vector<std::string> keys{};
+  for (auto it = trie.begin(); it != trie.end(); ++it) {
+    keys.push_back(it.key());
+    it.value()[0] = 0;
+  }
+  REQUIRE(keys == std::vector<std::string>{"AB", "A", "B"});
+  REQUIRE((*trie.subtrie_iterator("A")).second[0] == 0);
+
+  REQUIRE(trie.erase("AB") == std::optional<Value>([&] {
+            Value v = value_of(2);
+            v[0] = 0;
+            return v;
+          }()));
+  REQUIRE_FALSE(trie.has_key("AB"));
+
+  // the slot of an erased key is reused
+  trie["XYZ"] = value_of(5);
+  DetachedTrie copy(trie);
+  trie.erase("XYZ");
+  REQUIRE(copy.at("XYZ") == value_of(5));
+
+  int sum = 0;
+  copy.for_each_value([&sum](Value &v) { sum += v[1]; });
+  REQUIRE(sum == 4 + 3 + 5);
+}
+
+TEST_CASE("Sets of keys", "[trie set]") {
+  StringSet set{};
+  REQUIRE(set.insert("A"));
+  REQUIRE(set.insert("AB"));
+  REQUIRE(set.insert("B"));
+  REQUIRE(set.insert("ABC"));
+  REQUIRE_FALSE(set.insert("AB"));
+
+  SECTION("Membership") {
+    REQUIRE(set.contains("A"));
+    REQUIRE(set.contains("ABC"));
+    REQUIRE_FALSE(set.contains(""));
+    REQUIRE_FALSE(set.contains("C"));
+    REQUIRE_FALSE(set.contains("ABCD"));
+  }
+
+  SECTION("Enumeration") {
+    std::vector<std::string> keys{};
+    for (auto key : set) {
+      keys.push_back(key);
+    }
+    REQUIRE(keys == std::vector<std::string>{"ABC", "AB", "A", "B"});
+
+    keys.clear();
+    for (auto it = set.subtrie_iterator("AB"); it != set.end(); ++it) {
+      keys.push_back(*it);
+    }
+    REQUIRE(keys == std::vector<std::string>{"ABC", "AB"});
+    REQUIRE(set.subtrie_iterator("X") == set.end());
+    REQUIRE(StringSet{}.begin() == StringSet{}.end());
+  }
+
+  SECTION("Erasing and copying") {
+    REQUIRE(set.erase("AB"));
+    REQUIRE_FALSE(set.erase("AB"));
+    REQUIRE_FALSE(set.erase("X"));
+    StringSet copy(set);
+    REQUIRE(set.erase("ABC"));
+    REQUIRE(copy.contains("ABC"));
+    REQUIRE_FALSE(copy.contains("AB"));
+
+    std::vector<std::string> keys{};
+    for (auto key : set) {
+      keys.push_back(key);
+    }
+    REQUIRE(keys == std::vector<std::string>{"A", "B"});
+  }
+
+  SECTION("Keys of other types") {
+    TrieSet<std::vector<int>> int_set{};
+    int_set.insert({1, 2});
+    int_set.insert({1, 3});
+    REQUIRE(int_set.contains({1, 3}));
+    REQUIRE(*int_set.subtrie_iterator({1}) == std::vector<int>{1, 2});
+  }
+}
+
+TEST_CASE("Looking up keys of other types", "[trie heterogeneous]") {
+  StringStringTrie trie{};
+  trie.insert("AB", "1");
+  trie.insert("ABC", "2");
+  trie.insert("B", "3");
+
+  SECTION("string_view and C strings") {
+    std::string_view view = "ABCD";
+    REQUIRE(trie.at(view.substr(0, 2)) == "1");
+    REQUIRE(trie.has_key(view.substr(0, 3)));
+    REQUIRE_FALSE(trie.has_key(view));
+    REQUIRE_FALSE(trie.has_key(view.substr(0, 1)));
+    const char *c_string = "B";
+    REQUIRE(trie.at(c_string) == "3");
+    REQUIRE(trie.at("X") == std::nullopt);
+    REQUIRE((*trie.subtrie_iterator(view, 2)).first == "ABC");
+    REQUIRE(trie.subtrie_iterator(std::string_view("X")) == trie.end());
+
+    trie[std::string_view("AB")] = "4";
+    trie[view] = "5";
+    REQUIRE(trie.at("AB") == "4");
+    REQUIRE(trie.subtrie_iterator("ABCD").key() == "ABCD");
+  }
+
+  SECTION("Spans") {
+    Trie<std::vector<int>, int> int_trie{};
+    int_trie.insert({1, 2, 3}, 4);
+    std::array<int, 4> buffer{1, 2, 3, 4};
+    std::span<const int> span(buffer);
+    REQUIRE(int_trie.at(span.first(3)) == 4);
+    REQUIRE_FALSE(int_trie.has_key(span));
+    int_trie[span] = 5;
+    REQUIRE(int_trie.at({1, 2, 3, 4}) == 5);
+  }
+
+  SECTION("Sets") {
+    StringSet set{};
+    set.insert("AB");
+    REQUIRE(set.contains(std::string_view("ABC").substr(0, 2)));
+    REQUIRE(set.contains("AB"));
+    REQUIRE_FALSE(set.contains(std::string_view("A")));
+  }
+}
+
+TEST_CASE("Emplacing values and finding them without copies",
+          "[trie emplace]") {
+  Trie<std::string, std::vector<int>> trie{};
+
+  SECTION("try_emplace") {
+    auto [value, inserted] = trie.try_emplace("AB", 3, 7);
+    REQUIRE(inserted);
+    REQUIRE(*value == std::vector<int>{7, 7, 7});
+    std::vector<int> other{1};
+    auto [same_value, inserted_again] =
+        trie.try_emplace("AB", std::move(other));
+    REQUIRE_FALSE(inserted_again);
+    REQUIRE(same_value == value);
+    REQUIRE(other == std::vector<int>{1});
+    REQUIRE(trie.begin().key() == "AB");
+  }
+
+  SECTION("insert_or_assign") {
+    std::vector<int> moved{1, 2};
+    REQUIRE(trie.insert_or_assign("A", std::move(moved)).second);
+    REQUIRE(moved.empty());
+    auto [value, inserted] = trie.insert_or_assign("A", std::vector<int>{3});
+    REQUIRE_FALSE(inserted);
+    REQUIRE(*value == std::vector<int>{3});
+    REQUIRE(trie.at("A") == std::vector<int>{3});
+  }
+
+  SECTION("find") {
+    trie.insert("ABC", {1});
+    REQUIRE(trie.find("AB") == nullptr);
+    REQUIRE(trie.find(std::string("X")) == nullptr);
+    trie.find("ABC")->push_back(2);
+    const auto &const_trie = trie;
+    REQUIRE(*const_trie.find(std::string_view("ABC")) ==
+            std::vector<int>{1, 2});
+  }
+}
+
+TEST_CASE("Updating values through node handles", "[trie handle]") {
+  Trie<std::string, int> trie{};
+  trie.insert("AB", 1);
+  auto ab = trie.handle("AB");
+  auto abc = trie.handle("ABC");
+  REQUIRE(ab);
+  REQUIRE_FALSE(decltype(ab){});
+  REQUIRE(ab.key() == "AB");
+  REQUIRE(**ab == 1);
+  REQUIRE_FALSE(abc->has_value());
+
+  **ab += 1;
+  *abc = 5;
+  REQUIRE(trie.at("AB") == 2);
+  REQUIRE(trie.at("ABC") == 5);
+
+  // handles stay valid while other keys are inserted and erased
+  for (char c = 'a'; c <= 'z'; c++) {
+    trie.insert(std::string("AB") + c, c);
+  }
+  trie.erase("ABd");
+  trie.erase("A");
+  **abc += 1;
+  REQUIRE(trie.at("ABC") == 6);
+  REQUIRE(**trie.handle("ABC") == 6);
+}
+
+TEST_CASE("Descending with a cursor", "[trie cursor]") {
+  StringStringTrie trie{};
+  trie.insert("A", "1");
+  trie.insert("AB", "2");
+  trie.insert("AC", "3");
+  trie.insert("ACD", "4");
+
+  auto cursor = trie.cursor();
+  REQUIRE(cursor.valid());
+  REQUIRE_FALSE(cursor.has_value());
+  REQUIRE_FALSE(cursor.ascend());
+
+  REQUIRE(cursor.descend('A'));
+  REQUIRE(cursor.has_value());
+  REQUIRE(cursor.key() == "A");
+  REQUIRE(cursor.value() == "1");
+  std::string children{};
+  cursor.for_each_child([&](char symbol) { children.push_back(symbol); });
+  REQUIRE(children == "BC");
+
+  REQUIRE(cursor.descend('C'));
+  cursor.value() = "5";
+  REQUIRE(trie.at("AC") == "5");
+  std::vector<std::string> keys{};
+  for (auto it = cursor.subtrie(); it != trie.end(); ++it) {
+    keys.push_back(it.key());
+  }
+  REQUIRE(keys == std::vector<std::string>{"ACD", "AC"});
+
+  // leaving the trie and coming back
+  REQUIRE_FALSE(cursor.descend('X'));
+  REQUIRE_FALSE(cursor.descend('D'));
+  REQUIRE_FALSE(cursor.valid());
+  REQUIRE_FALSE(cursor.has_value());
+  REQUIRE(cursor.subtrie() == trie.end());
+  REQUIRE(cursor.ascend());
+  REQUIRE(cursor.ascend());
+  REQUIRE(cursor.descend('D'));
+  REQUIRE(cursor.key() == "ACD");
+  REQUIRE(cursor.ascend());
+  REQUIRE(cursor.ascend());
+  REQUIRE(cursor.ascend());
+  REQUIRE_FALSE(cursor.ascend());
+}
+
+TEST_CASE("Finger search", "[trie finger]") {
+  StringStringTrie trie{};
+  trie.insert("ABC", "1");
+  trie.insert("ABD", "2");
+  trie.insert("B", "3");
+  StringStringTrie::Finger finger{};
+
+  REQUIRE(trie.at("ABC", finger) == "1");
+  REQUIRE(trie.at("ABD", finger) == "2");
+  REQUIRE(trie.at("AB", finger) == std::nullopt);
+  REQUIRE(trie.at("ABX", finger) == std::nullopt);
+  REQUIRE(trie.at("ABD", finger) == "2");
+  REQUIRE(trie.at("B", finger) == "3");
+  REQUIRE(trie.at("", finger) == std::nullopt);
+
+  // keys inserted after a lookup are found
+  trie.insert("ABDE", "4");
+  REQUIRE(trie.at("ABD", finger) == "2");
+  *trie.find("ABDE", finger) = "5";
+  REQUIRE(trie.at("ABDE") == "5");
+
+  // the finger starts over when used with another trie
+  StringStringTrie other(trie);
+  REQUIRE(other.find("ABDE", finger) != trie.find("ABDE"));
+  REQUIRE(trie.find("ABDE", finger) == trie.find("ABDE"));
+}
+
+TEST_CASE("Lookups in key order", "[trie ordered]") {
+  StringStringTrie trie{};
+  std::map<std::string, std::string> reference{};
+  for (std::string key : {"B", "ABC", "A", "AC", "BAA", "D", "AB", "ACA"}) {
+    trie.insert(key, key);
+    reference[key] = key;
+  }
+
+  SECTION("Enumeration") {
+    std::vector<std::string> keys{};
+    for (auto it = trie.ordered_begin(); it != trie.ordered_end(); ++it) {
+      keys.push_back(it.key());
+    }
+    REQUIRE(keys == std::vector<std::string>{"A", "AB", "ABC", "AC", "ACA",
+                                             "B", "BAA", "D"});
+    REQUIRE(StringStringTrie{}.ordered_begin() ==
+            StringStringTrie{}.ordered_end());
+  }
+
+  SECTION("lower_bound and upper_bound agree with std::map") {
+    for (std::string probe : {"", "A", "AA", "AB", "ABD", "ACA", "ACB", "B",
+                              "BA", "BAAA", "C", "D", "E"}) {
+      auto lower = trie.lower_bound(probe);
+      auto reference_lower = reference.lower_bound(probe);
+      if (reference_lower == reference.end()) {
+        REQUIRE(lower == trie.ordered_end());
+      } else {
+        REQUIRE(lower.key() == reference_lower->first);
+      }
+      auto upper = trie.upper_bound(probe);
+      auto reference_upper = reference.upper_bound(probe);
+      if (reference_upper == reference.end()) {
+        REQUIRE(upper == trie.ordered_end());
+      } else {
+        REQUIRE(upper.key() == reference_upper->first);
+      }
+    }
+  }
+
+  SECTION("Ranges") {
+    auto [first, last] = trie.equal_range("AC");
+    REQUIRE(first.key() == "AC");
+    REQUIRE(last.key() == "ACA");
+    std::vector<std::string> keys{};
+    for (auto entry : trie.range("AB", "B")) {
+      keys.push_back(entry.first);
+    }
+    REQUIRE(keys == std::vector<std::string>{"AB", "ABC", "AC", "ACA"});
+    for (auto it = trie.range("BA", "Z").begin(); it != trie.ordered_end();
+         ++it) {
+      it.value() = "x";
+    }
+    REQUIRE(trie.at("BAA") == "x");
+    REQUIRE(trie.at("B") == "B");
+  }
+}
+
+TEST_CASE("Longest prefix matches", "[trie prefix match]") {
+  SECTION("Strings") {
+    StringStringTrie trie{};
+    trie.insert("49", "Germany");
+    trie.insert("4930", "Berlin");
+    trie.insert("1", "NANP");
+    REQUIRE(trie.longest_prefix_match("493012345") ==
+            std::make_pair(std::size_t{4}, std::string("Berlin")));
+    REQUIRE(trie.longest_prefix_match(std::string_view("4989")) ==
+            std::make_pair(std::size_t{2}, std::string("Germany")));
+    REQUIRE(trie.longest_prefix_match("4930") ==
+            std::make_pair(std::size_t{4}, std::string("Berlin")));
+    REQUIRE(trie.longest_prefix_match("4") == std::nullopt);
+    REQUIRE(trie.longest_prefix_match("33") == std::nullopt);
+    REQUIRE(trie.all_prefix_matches("493099").size() == 2);
+    REQUIRE(trie.all_prefix_matches("493099")[0].second == "Germany");
+    REQUIRE(trie.all_prefix_matches("5").empty());
+
+    trie.insert("", "World");
+    REQUIRE(trie.longest_prefix_match("5") ==
+            std::make_pair(std::size_t{0}, std::string("World")));
+  }
+
+  SECTION("Routes") {
+    using Route = BitPrefix<std::uint32_t>;
+    Trie<Route, int, BitPrefixConverter<std::uint32_t>,
+         ArrayStorage<Route, bool, int, 2>>
+        routes{};
+    routes.insert(Route{0x0a000000, 8}, 1);  // 10.0.0.0/8
+    routes.insert(Route{0x0a010000, 16}, 2); // 10.1.0.0/16
+    routes.insert(Route{0x00000000, 0}, 0);  // default route
+    routes.insert(Route{0xc0a80100, 24}, 3); // 192.168.1.0/24
+    REQUIRE(routes.longest_prefix_match(Route{0x0a010203, 32})->second == 2);
+    REQUIRE(routes.longest_prefix_match(Route{0x0a020203, 32})->second == 1);
+    REQUIRE(routes.longest_prefix_match(Route{0xc0a80101, 32})->first == 24);
+    REQUIRE(routes.longest_prefix_match(Route{0xc0a80201, 32})->second == 0);
+    REQUIRE(routes.all_prefix_matches(Route{0x0a010203, 32}).size() == 3);
+  }
+}
+
+TEST_CASE("Compiling routes into a forwarding table", "[ip fib]") {
+  Trie<Ipv4Route, int, BitPrefixConverter<std::uint32_t>,
+       ArrayStorage<Ipv4Route, bool, int, 2>>
+      routes{};
+  routes.insert(Ipv4Route{0x0a000000, 8}, 1);
+  routes.insert(Ipv4Route{0x0a010000, 16}, 2);
+  routes.insert(Ipv4Route{0x0a010180, 25}, 3);
+  routes.insert(Ipv4Route{0x0a0101c1, 32}, 4);
+  routes.insert(Ipv4Route{0xc0a80000, 23}, 5);
+  Ipv4Fib<int> fib(routes);
+
+  REQUIRE(fib.lookup(0x0b000000) == nullptr);
+  REQUIRE(*fib.lookup(0x0a020304) == 1);
+  REQUIRE(*fib.lookup(0x0a010001) == 2);
+  REQUIRE(*fib.lookup(0x0a01017f) == 2);
+  REQUIRE(*fib.lookup(0x0a010180) == 3);
+  REQUIRE(*fib.lookup(0x0a0101c1) == 4);
+  REQUIRE(*fib.lookup(0x0a0101c2) == 3);
+  REQUIRE(*fib.lookup(0xc0a801ff) == 5);
+  REQUIRE(fib.lookup(0xc0a80200) == nullptr);
+
+  // agrees with the trie for addresses around all route boundaries
+  for (std::uint32_t base : {0x0a000000u, 0x0a010000u, 0x0a010100u,
+                             0xc0a80000u, 0xc0a80100u}) {
+    for (std::uint32_t host = 0; host < 512; host++) {
+      std::uint32_t address = base - 256 + host;
+      auto match = routes.longest_prefix_match(Ipv4Route{address, 32});
+      const int *next_hop = fib.lookup(address);
+      REQUIRE(match.has_value() == (next_hop != nullptr));
+      if (match) {
+        REQUIRE(match->second == *next_hop);
+      }
+    }
+  }
+
+  AtomicFib<int> current(std::make_shared<const Ipv4Fib<int>>(routes));
+  auto snapshot = current.load();
+  routes.insert(Ipv4Route{0, 0}, 0);
+  current.rebuild(routes);
+  REQUIRE(*current.load()->lookup(0x0b000000) == 0);
+  REQUIRE(snapshot->lookup(0x0b000000) == nullptr);
+}
+
+TEST_CASE("Integer keys with multi-bit strides", "[trie stride]") {
+  SECTION("Numeric order") {
+    using Converter = IntStrideConverter<std::int32_t, 4>;
+    Trie<std::int32_t, int, Converter,
+         ArrayStorage<std::int32_t, std::uint8_t, int,
+                      Converter::alphabet_size>>
+        trie{};
+    std::vector<std::int32_t> keys{5, -3, 100000, -100000, 0, 7, INT32_MIN};
+    for (std::int32_t key : keys) {
+      trie.insert(key, key);
+    }
+    REQUIRE(Converter::size(0) == 8);
+    std::sort(keys.begin(), keys.end());
+    std::vector<std::int32_t> enumerated{};
+    for (auto it = trie.ordered_begin(); it != trie.ordered_end(); ++it) {
+      enumerated.push_back(it.key());
+    }
+    REQUIRE(enumerated == keys);
+    REQUIRE(trie.lower_bound(6).key() == 7);
+  }
+
+  SECTION("Strides and bit orders") {
+    using Msb = IntStrideConverter<std::uint64_t, 8>;
+    using Lsb = IntStrideConverter<std::uint64_t, 2, BitOrder::lsb_first>;
+    REQUIRE(Msb::get_at_index(0x0102030405060708, 0) == 1);
+    REQUIRE(Msb::get_at_index(0x0102030405060708, 7) == 8);
+    REQUIRE(Lsb::size(0) == 32);
+    REQUIRE(Lsb::get_at_index(0b1110, 0) == 2);
+    REQUIRE(Lsb::get_at_index(0b1110, 1) == 3);
+    REQUIRE(IntStrideConverter<std::uint16_t, 16>::get_at_index(65535, 0) ==
+            65535);
+
+    Trie<std::uint64_t, int, Msb,
+         HybridStorage<std::uint64_t, std::uint8_t, int, Msb::alphabet_size>>
+        trie{};
+    trie.insert(0x0102030405060708, 1);
+    trie.insert(0x0102030405060709, 2);
+    REQUIRE(trie.at(0x0102030405060709) == 2);
+    REQUIRE_FALSE(trie.has_key(0x0102030405060700));
+  }
+
+#ifdef __SIZEOF_INT128__
+  SECTION("128-bit keys") {
+    Trie<Int128, int, IntStrideConverter<Int128, 16>> trie{};
+    trie.insert(Int128{1} << 100, 1);
+    trie.insert(-1, 2);
+    REQUIRE(trie.at(Int128{1} << 100) == 1);
+    REQUIRE(trie.ordered_begin().value() == 2);
+  }
+#endif
+}
+
+TEST_CASE("Crit-bit trees", "[critbit]") {
+  SECTION("String keys") {
+    CritBitTree<std::string, int> tree{};
+    REQUIRE(tree.begin() == tree.end());
+    REQUIRE_FALSE(tree.has_key(""));
+    REQUIRE(tree.insert("B", 1) == std::nullopt);
+    REQUIRE(tree.insert("AB", 2) == std::nullopt);
+    REQUIRE(tree.insert("A", 3) == std::nullopt);
+    REQUIRE(tree.insert("ABC", 4) == std::nullopt);
+    REQUIRE(tree.insert("", 5) == std::nullopt);
+    REQUIRE(tree.insert(std::string("A\0", 2), 6) == std::nullopt);
+    REQUIRE(tree.insert("AB", 7) == 2);
+
+    REQUIRE(tree.at("AB") == 7);
+    REQUIRE(tree.at(std::string("A\0", 2)) == 6);
+    REQUIRE(tree.at("") == 5);
+    REQUIRE(tree.at("C") == std::nullopt);
+    REQUIRE(tree.at("ABCD") == std::nullopt);
+    REQUIRE_FALSE(tree.has_key("AC"));
+
+    std::vector<std::string> keys{};
+    for (auto entry : tree) {
+      keys.push_back(entry.first);
+    }
+    REQUIRE(keys == std::vector<std::string>{"", "A", std::string("A\0", 2),
+                                             "AB", "ABC", "B"});
+    keys.clear();
+    for (auto it = tree.subtrie_iterator("AB"); it != tree.end(); ++it) {
+      keys.push_back(it.key());
+    }
+    REQUIRE(keys == std::vector<std::string>{"AB", "ABC"});
+    REQUIRE(tree.subtrie_iterator("AC") == tree.end());
+    REQUIRE(tree.subtrie_iterator("ABCD") == tree.end());
+    REQUIRE(tree.subtrie_iterator("").key() == "");
+
+    CritBitTree<std::string, int> copy(tree);
+    REQUIRE(tree.erase("A") == 3);
+    REQUIRE(tree.erase("A") == std::nullopt);
+    REQUIRE(tree.erase("") == 5);
+    REQUIRE_FALSE(tree.has_key("A"));
+    REQUIRE(tree.at("AB") == 7);
+    REQUIRE(copy.at("A") == 3);
+    tree["X"] = 8;
+    *tree["AB"] += 1;
+    REQUIRE(tree.at("AB") == 8);
+    REQUIRE(tree.begin().key() == std::string("A\0", 2));
+  }
+
+  SECTION("Integer keys") {
+    CritBitTree<std::uint32_t, int, IntStrideConverter<std::uint32_t, 8>>
+        tree{};
+    std::vector<std::uint32_t> keys{7, 70000, 3, 0xffffffff, 0, 256};
+    for (std::uint32_t key : keys) {
+      tree.insert(key, static_cast<int>(key % 1000));
+    }
+    std::sort(keys.begin(), keys.end());
+    std::vector<std::uint32_t> enumerated{};
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+      enumerated.push_back(it.key());
+    }
+    REQUIRE(enumerated == keys);
+    REQUIRE(tree.at(70000) == 0);
+    REQUIRE_FALSE(tree.has_key(8));
+    for (std::uint32_t key : keys) {
+      REQUIRE(tree.erase(key).has_value());
+    }
+    REQUIRE(tree.begin() == tree.end());
+  }
+}
+
+TEST_CASE("Matching many keys in a text", "[aho corasick]") {
+  StringStringTrie trie{};
+  trie.insert("he", "he");
+  trie.insert("she", "she");
+  trie.insert("his", "his");
+  trie.insert("hers", "hers");
+  trie.insert("", "empty");
+
+  using Match = std::pair<std::size_t, std::string>;
+  auto matches_in = [](const AhoCorasick<std::string> &automaton,
+                       std::string_view text) {
+    std::vector<Match> matches{};
+    automaton.scan(text, [&](std::size_t begin, std::size_t length,
+                             const std::string &value) {
+      REQUIRE(text.substr(begin, length) == value);
+      matches.emplace_back(begin, value);
+    });
+    return matches;
+  };
+
+  for (std::size_t max_dense_entries : {std::size_t{1} << 24, std::size_t{0}}) {
+    AhoCorasick<std::string> automaton(trie, max_dense_entries);
+    REQUIRE(automaton.is_dense() == (max_dense_entries != 0));
+    REQUIRE(matches_in(automaton, "ushers") ==
+            std::vector<Match>{{1, "she"}, {2, "he"}, {2, "hers"}});
+    REQUIRE(matches_in(automaton, "ahishe!") ==
+            std::vector<Match>{{1, "his"}, {3, "she"}, {4, "he"}});
+    REQUIRE(matches_in(automaton, "xyz").empty());
+    REQUIRE(matches_in(automaton, "").empty());
+
+    // matches that span chunks
+    std::vector<Match> matches{};
+    AhoCorasick<std::string>::Position position{};
+    for (std::string_view chunk : {"us", "h", "", "ers"}) {
+      automaton.scan(
+          chunk,
+          [&](std::size_t begin, std::size_t, const std::string &value) {
+            matches.emplace_back(begin, value);
+          },
+          position);
+    }
+    REQUIRE(position.offset == 6);
+    REQUIRE(matches == matches_in(automaton, "ushers"));
+  }
+
+  SECTION("Against naive search") {
+    Trie<std::string, int> words{};
+    std::vector<std::string> keys{"a", "ab", "bab", "bc", "bca", "c", "caa"};
+    for (std::size_t i = 0; i != keys.size(); i++) {
+      words.insert(keys[i], static_cast<int>(i));
+    }
+    AhoCorasick<int> automaton(words);
+    std::string text = "abccab\0abcabcaabcbab";
+    std::size_t found = 0;
+    automaton.scan(text, [&](std::size_t begin, std::size_t length, int key) {
+      REQUIRE(text.compare(begin, length, keys[key]) == 0);
+      found++;
+    });
+    std::size_t expected = 0;
+    for (const std::string &key : keys) {
+      for (std::size_t pos = text.find(key); pos != std::string::npos;
+           pos = text.find(key, pos + 1)) {
+        expected++;
+      }
+    }
+    REQUIRE(found == expected);
+  }
+}
+
+TEST_CASE("Tokenizing text", "[trie tokenize]") {
+  StringStringTrie vocabulary{};
+  for (std::string word : {"a", "an", "and", "any", "tan", "t", "dy"}) {
+    vocabulary.insert(word, word);
+  }
+  vocabulary.insert("", "empty");
+
+  using Token = StringStringTrie::Token;
+  auto words_of = [](const std::vector<Token> &tokens) {
+    std::vector<std::string> words{};
+    for (const Token &token : tokens) {
+      words.push_back(token.value ? *token.value : "?");
+    }
+    return words;
+  };
+
+  std::vector<Token> tokens{};
+  REQUIRE(vocabulary.tokenize("tandy", std::back_inserter(tokens)) == 5);
+  REQUIRE(words_of(tokens) == std::vector<std::string>{"tan", "dy"});
+  REQUIRE(tokens[1].offset == 3);
+  REQUIRE(tokens[1].length == 2);
+
+  tokens.clear();
+  REQUIRE(vocabulary.tokenize(std::string_view("anyxxan!"),
+                              std::back_inserter(tokens)) == 8);
+  REQUIRE(words_of(tokens) ==
+          std::vector<std::string>{"any", "?", "?", "an", "?"});
+  REQUIRE(tokens[2].offset == 4);
+
+  tokens.clear();
+  vocabulary.tokenize("anyxxan!", std::back_inserter(tokens),
+                      Unmatched::merge);
+  REQUIRE(words_of(tokens) == std::vector<std::string>{"any", "?", "an", "?"});
+  REQUIRE(tokens[1].offset == 3);
+  REQUIRE(tokens[1].length == 2);
+
+  tokens.clear();
+  vocabulary.tokenize("xanyxxan!", std::back_inserter(tokens),
+                      Unmatched::skip);
+  REQUIRE(words_of(tokens) == std::vector<std::string>{"any", "an"});
+
+  tokens.clear();
+  REQUIRE(vocabulary.tokenize("anyxxan!", std::back_inserter(tokens),
+                              Unmatched::stop) == 3);
+  REQUIRE(words_of(tokens) == std::vector<std::string>{"any"});
+
+  tokens.clear();
+  REQUIRE(vocabulary.tokenize("", std::back_inserter(tokens)) == 0);
+  REQUIRE(tokens.empty());
+}
+
+TEST_CASE("Fuzzy search", "[trie fuzzy]") {
+  std::vector<std::string> words{"",      "a",     "cat",   "cart", "card",
+                                 "care",  "cast",  "coat",  "dog",  "scat",
+                                 "act",   "catty", "ca",    "tac",  "cats"};
+  StringStringTrie trie{};
+  for (const std::string &word : words) {
+    trie.insert(word, word);
+  }
+
+  auto distance = [](const std::string &a, const std::string &b) {
+    std::vector<std::size_t> row(b.size() + 1);
+    for (std::size_t j = 0; j <= b.size(); j++) {
+      row[j] = j;
+    }
+    for (std::size_t i = 1; i <= a.size(); i++) {
+      std::size_t diagonal = row[0];
+      row[0] = i;
+      for (std::size_t j = 1; j <= b.size(); j++) {
+        std::size_t above = row[j];
+        row[j] = std::min({row[j] + 1, row[j - 1] + 1,
+                           diagonal + (a[i - 1] != b[j - 1])});
+        diagonal = above;
+      }
+    }
+    return row[b.size()];
+  };
+
+  for (std::string query : {"cat", "cta", "", "kart", "catsy", "xyzzy"}) {
+    for (std::size_t max_edits = 0; max_edits <= 3; max_edits++) {
+      std::map<std::string, std::size_t> expected{};
+      for (const std::string &word : words) {
+        if (distance(query, word) <= max_edits) {
+          expected[word] = distance(query, word);
+        }
+      }
+      std::map<std::string, std::size_t> found{};
+      for (auto &match : trie.fuzzy_search(query, max_edits)) {
+        REQUIRE(*match.value == match.key);
+        found[match.key] = match.distance;
+      }
+      REQUIRE(found == expected);
+    }
+  }
+
+  REQUIRE(trie.fuzzy_search(std::string_view("cat"), 0).size() == 1);
+  REQUIRE(trie.fuzzy_search("dgo", 2).at(0).key == "dog");
+}
+
+TEST_CASE("Pattern search", "[trie pattern]") {
+  std::vector<std::string> words{"",       "cat",      "cot",
+                                 "cut",    "coat",     "ct",
+                                 "act",    "pseudo",   "station",
+                                 "nation", "pseudonation", "c?t",
+                                 "c*t",    "unable",   "reusable",
+                                 "able",   "ununable"};
+  StringStringTrie trie{};
+  for (const std::string &word : words) {
+    trie.insert(word, word);
+  }
+  auto keys_matching = [&](const KeyPattern<char> &pattern) {
+    std::vector<std::string> keys{};
+    for (auto &[key, value] : trie.pattern_search(pattern)) {
+      REQUIRE(*value == key);
+      keys.push_back(key);
+    }
+    std::sort(keys.begin(), keys.end());
+    return keys;
+  };
+  using Strings = std::vector<std::string>;
+
+  SECTION("Globs") {
+    auto glob = [](std::string_view pattern) {
+      return KeyPattern<char>::glob(pattern);
+    };
+    REQUIRE(keys_matching(glob("c?t")) ==
+            Strings{"c*t", "c?t", "cat", "cot", "cut"});
+    REQUIRE(keys_matching(glob("c*t")) ==
+            Strings{"c*t", "c?t", "cat", "coat", "cot", "ct", "cut"});
+    REQUIRE(keys_matching(glob("pseudo*tion")) == Strings{"pseudonation"});
+    REQUIRE(keys_matching(glob("*tion")) ==
+            Strings{"nation", "pseudonation", "station"});
+    REQUIRE(keys_matching(glob("c\\?t")) == Strings{"c?t"});
+    REQUIRE(keys_matching(glob("c[a-o]t")) == Strings{"cat", "cot"});
+    REQUIRE(keys_matching(glob("c[^a-o]t")) == Strings{"c*t", "c?t", "cut"});
+    REQUIRE(keys_matching(glob("")) == Strings{""});
+    REQUIRE(keys_matching(glob("*")).size() == words.size());
+    REQUIRE(keys_matching(glob("dog")).empty());
+  }
+
+  SECTION("Regular expressions") {
+    auto regex = [](std::string_view pattern) {
+      return KeyPattern<char>::regex(pattern);
+    };
+    REQUIRE(keys_matching(regex("c.t")) ==
+            Strings{"c*t", "c?t", "cat", "cot", "cut"});
+    REQUIRE(keys_matching(regex("co?a?t")) ==
+            Strings{"cat", "coat", "cot", "ct"});
+    REQUIRE(keys_matching(regex("(un|re)+[a-z]*able")) ==
+            Strings{"reusable", "unable", "ununable"});
+    REQUIRE(keys_matching(regex("(un)*able")) ==
+            Strings{"able", "unable", "ununable"});
+    REQUIRE(keys_matching(regex("c(a|o|u)t|act|")) ==
+            Strings{"", "act", "cat", "cot", "cut"});
+    REQUIRE(keys_matching(regex("c\\*t")) == Strings{"c*t"});
+    REQUIRE(keys_matching(regex(".*")).size() == words.size());
+    REQUIRE_THROWS_AS(regex("(ab"), std::invalid_argument);
+    REQUIRE_THROWS_AS(regex("ab)"), std::invalid_argument);
+    REQUIRE_THROWS_AS(regex("*a"), std::invalid_argument);
+    REQUIRE_THROWS_AS(regex("[ab"), std::invalid_argument);
+  }
+}
+
+TEST_CASE("Top-k keys by value", "[trie top k]") {
+#ifdef TEST_USE_ARRAY
+  using ScoreTrie =
+      Trie<std::string, Aggregated<int, MaxOf<int>>,
+           DummyConverter<std::string>,
+           ArrayStorage<std::string, char, Aggregated<int, MaxOf<int>>, 256>>;
+#elif TEST_USE_HYBRID
+  using ScoreTrie =
+      Trie<std::string, Aggregated<int, MaxOf<int>>,
+           DummyConverter<std::string>,
+           HybridStorage<std::string, char, Aggregated<int, MaxOf<int>>, 256,
+                         2, 1>>;
+#else
+  using ScoreTrie = Trie<std::string, Aggregated<int, MaxOf<int>>>;
+#endif
+  ScoreTrie trie{};
+  std::map<std::string, int> scores{
+      {"", 0},     {"s", 1},    {"sa", 7},  {"sad", 3},  {"safe", 12},
+      {"sag", 2},  {"sea", 9},  {"seal", 4}, {"see", 20}, {"seed", 8},
+      {"so", 11},  {"t", 5},    {"tea", 30}};
+  for (auto &[key, score] : scores) {
+    trie.insert(key, score);
+  }
+
+  // the keys with the k largest scores below prefix, largest first
+  auto expected = [&](std::string_view prefix, std::size_t k) {
+    std::vector<std::pair<int, std::string>> matching{};
+    for (auto &[key, score] : scores) {
+      if (key.starts_with(prefix)) {
+        matching.emplace_back(score, key);
+      }
+    }
+    std::sort(matching.rbegin(), matching.rend());
+    matching.resize(std::min(k, matching.size()));
+    std::vector<int> result{};
+    for (auto &match : matching) {
+      result.push_back(match.first);
+    }
+    return result;
+  };
+  auto top_k = [&](std::string_view prefix, std::size_t k) {
+    std::vector<int> result{};
+    for (auto &[key, value] : trie.top_k(prefix, k)) {
+      REQUIRE(scores.at(key) == *value);
+      result.push_back(*value);
+    }
+    return result;
+  };
+  auto check = [&] {
+    for (std::string prefix : {"", "s", "sa", "se", "see", "t", "x", "safe"}) {
+      for (std::size_t k : {0, 1, 3, 20}) {
+        REQUIRE(top_k(prefix, k) == expected(prefix, k));
+      }
+    }
+  };
+
+  check();
+  REQUIRE(trie.top_k("s", 2) ==
+          std::vector<std::pair<std::string, const int *>>{
+              {"see", trie.find("see")}, {"safe", trie.find("safe")}});
+
+  // the aggregates follow every way of changing values
+  trie.insert("sag", 50);
+  scores["sag"] = 50;
+  check();
+  *trie["seal"] = 25;
+  scores["seal"] = 25;
+  check();
+  trie.subtrie_iterator("tea").value() = -1;
+  scores["tea"] = -1;
+  check();
+  *trie.find("see") = 1;
+  scores["see"] = 1;
+  check();
+  trie.erase("sag");
+  scores.erase("sag");
+  check();
+  trie.for_each_value([](int &score) { score *= 2; });
+  for (auto &entry : scores) {
+    entry.second *= 2;
+  }
+  check();
+  trie.insert("sagging", 40);
+  scores["sagging"] = 40;
+  check();
+
+  ScoreTrie copy(trie);
+  trie.erase("sagging");
+  REQUIRE(copy.top_k("sa", 1).at(0).first == "sagging");
+  REQUIRE(trie.top_k("sa", 1).at(0).first == "safe");
+}
+
+TEST_CASE("Counting, ranking and selecting keys", "[trie count]") {
+  using Counted = Aggregated<int, CountOf<int>>;
+#ifdef TEST_USE_ARRAY
+  using CountTrie = Trie<std::string, Counted, DummyConverter<std::string>,
+                         ArrayStorage<std::string, char, Counted, 256>>;
+#elif TEST_USE_HYBRID
+  using CountTrie =
+      Trie<std::string, Counted, DummyConverter<std::string>,
+           HybridStorage<std::string, char, Counted, 256, 2, 1>>;
+#else
+  using CountTrie = Trie<std::string, Counted>;
+#endif
+  CountTrie trie{};
+  std::vector<std::string> keys{"",     "a",   "ab",  "abc", "abd", "b",
+                                "ba",   "bab", "bb",  "c",   "cab", "cc",
+                                "ccc",  "d",   "dab", "dd"};
+  for (std::size_t i = 0; i != keys.size(); i++) {
+    trie.insert(keys[i], static_cast<int>(i));
+  }
+  trie.erase("d");
+  keys.erase(std::find(keys.begin(), keys.end(), "d"));
+
+  auto check = [&] {
+    for (std::string prefix : {"", "a", "ab", "abc", "b", "c", "d", "x"}) {
+      REQUIRE(trie.count_prefix(prefix) ==
+              static_cast<std::size_t>(std::count_if(
+                  keys.begin(), keys.end(),
+                  [&](auto &key) { return key.starts_with(prefix); })));
+    }
+    for (std::string key : {"", "a", "aa", "abc", "abe", "b", "bc", "cc",
+                            "ccca", "d", "da", "z"}) {
+      REQUIRE(trie.rank(key) ==
+              static_cast<std::size_t>(
+                  std::lower_bound(keys.begin(), keys.end(), key) -
+                  keys.begin()));
+    }
+    for (std::size_t i = 0; i != keys.size(); i++) {
+      REQUIRE(trie.rank(keys[i]) == i);
+      REQUIRE(trie.select(i).key() == keys[i]);
+    }
+    REQUIRE(trie.select(keys.size()) == trie.ordered_end());
+  };
+  check();
+
+  // iteration continues after select()
+  std::vector<std::string> rest{};
+  for (auto it = trie.select(10); it != trie.ordered_end(); ++it) {
+    rest.push_back(it.key());
+  }
+  REQUIRE(rest == std::vector<std::string>(keys.begin() + 10, keys.end()));
+
+  trie.insert("abcd", 0);
+  keys.insert(std::upper_bound(keys.begin(), keys.end(), "abcd"), "abcd");
+  trie.erase("bab");
+  keys.erase(std::find(keys.begin(), keys.end(), "bab"));
+  trie.erase("");
+  keys.erase(keys.begin());
+  check();
+  REQUIRE(trie.count_prefix(std::string_view("ab")) == 4);
+}
+
+// The keys of the values in a subtrie, in the order in which they were
+// combined. Not commutative, so it also checks the order.
+struct Concatenation {
+  using value_type = std::string;
+
+  static std::string identity() { return ""; }
+
+  static std::string lift(const std::string &value) { return value + ";"; }
+
+  static std::string combine(const std::string &a, const std::string &b) {
+    return a + b;
+  }
+};
+
+TEST_CASE("Aggregates of subtries", "[trie aggregate]") {
+  SECTION("Sums") {
+    using Sizes = Aggregated<std::uint64_t, SumOf<std::uint64_t>>;
+#ifdef TEST_USE_ARRAY
+    using SizeTrie = Trie<std::string, Sizes, DummyConverter<std::string>,
+                          ArrayStorage<std::string, char, Sizes, 256>>;
+#elif TEST_USE_HYBRID
+    using SizeTrie =
+        Trie<std::string, Sizes, DummyConverter<std::string>,
+             HybridStorage<std::string, char, Sizes, 256, 2, 1>>;
+#else
+    using SizeTrie = Trie<std::string, Sizes>;
+#endif
+    SizeTrie objects{};
+    objects.insert("/a/x", 10);
+    objects.insert("/a/y", 20);
+    objects.insert("/a/y/z", 5);
+    objects.insert("/b/x", 100);
+    REQUIRE(objects.aggregate("") == 135);
+    REQUIRE(objects.aggregate("/a/") == 35);
+    REQUIRE(objects.aggregate(std::string_view("/a/y")) == 25);
+    REQUIRE(objects.aggregate("/c") == 0);
+
+    *objects["/a/x"] += 1;
+    REQUIRE(objects.aggregate("/a") == 36);
+    for (auto it = objects.subtrie_iterator("/a/y"); it != objects.end();
+         ++it) {
+      it.value() *= 2;
+    }
+    REQUIRE(objects.aggregate("/a") == 61);
+    REQUIRE(objects.erase("/a/y") == 40);
+    REQUIRE(objects.aggregate("/a") == 21);
+    REQUIRE(objects.aggregate("") == 121);
+    objects.erase("/a/y/z");
+    objects.erase("/a/x");
+    REQUIRE(objects.aggregate("/a") == 0);
+    REQUIRE(objects.aggregate("") == 100);
+    REQUIRE(objects.at("/b/x") == 100);
+  }
+
+  SECTION("Minima") {
+    Trie<std::string, Aggregated<int, MinOf<int>>> trie{};
+    trie.insert("ab", 3);
+    trie.insert("abc", -2);
+    trie.insert("b", 7);
+    REQUIRE(trie.aggregate("a") == -2);
+    REQUIRE(trie.aggregate("b") == 7);
+    trie.insert("abc", 4);
+    REQUIRE(trie.aggregate("") == 3);
+  }
+
+  SECTION("Order of combination") {
+    Trie<std::string, Aggregated<std::string, Concatenation>> trie{};
+    for (std::string key : {"b", "ab", "a", "abc", "aa", ""}) {
+      trie.insert(key, key);
+    }
+    REQUIRE(trie.aggregate("") == ";a;aa;ab;abc;b;");
+    REQUIRE(trie.aggregate("ab") == "ab;abc;");
+  }
+}
+
+TEST_CASE("Paginated prefix scans", "[trie scan]") {
+  StringStringTrie trie{};
+  std::vector<std::string> keys{"a",   "b",    "ba",  "bab", "bac", "bb",
+                                "bba", "bbb",  "bc",  "c",   "ca",  ""};
+  for (const std::string &key : keys) {
+    trie.insert(key, key + "!");
+  }
+
+  auto listing = [&](const std::string &prefix, std::size_t limit) {
+    std::vector<std::string> listed{};
+    std::optional<std::string> after_key{};
+    std::size_t pages = 0;
+    do {
+      auto page = trie.scan(prefix, after_key, limit);
+      REQUIRE(page.entries.size() <= limit);
+      for (auto &[key, value] : page.entries) {
+        REQUIRE(*value == key + "!");
+        listed.push_back(key);
+      }
+      after_key = page.continuation;
+      pages++;
+    } while (after_key);
+    return std::make_pair(listed, pages);
+  };
+
+  std::vector<std::string> with_b{"b",  "ba",  "bab", "bac",
+                                  "bb", "bba", "bbb", "bc"};
+  REQUIRE(listing("b", 3) == std::make_pair(with_b, std::size_t{3}));
+  REQUIRE(listing("b", 4) == std::make_pair(with_b, std::size_t{2}));
+  REQUIRE(listing("b", 8) == std::make_pair(with_b, std::size_t{1}));
+  REQUIRE(listing("b", 100).first == with_b);
+  REQUIRE(listing("", 5).first.size() == keys.size());
+  REQUIRE(listing("bb", 1).first ==
+          std::vector<std::string>{"bb", "bba", "bbb"});
+  REQUIRE(listing("x", 5).first.empty());
+
+  // resuming behind keys that are not in the trie
+  auto page = trie.scan("b", "bab0", 2);
+  REQUIRE(page.entries.at(0).first == "bac");
+  REQUIRE(page.continuation == "bb");
+  REQUIRE(trie.scan("b", "bz", 2).entries.empty());
+  REQUIRE(trie.scan("b", "a", 1).entries.at(0).first == "b");
+  REQUIRE(trie.scan("b", std::nullopt, 0).entries.empty());
+}
+
+TEST_CASE("Sampling keys", "[trie sample]") {
+  using Counted = Aggregated<int, CountOf<int>>;
+#ifdef TEST_USE_ARRAY
+  using CountTrie = Trie<std::string, Counted, DummyConverter<std::string>,
+                         ArrayStorage<std::string, char, Counted, 256>>;
+#elif TEST_USE_HYBRID
+  using CountTrie =
+      Trie<std::string, Counted, DummyConverter<std::string>,
+           HybridStorage<std::string, char, Counted, 256, 2, 1>>;
+#else
+  using CountTrie = Trie<std::string, Counted>;
+#endif
+  CountTrie trie{};
+  std::vector<std::string> keys{"",   "a",   "ab",  "abc", "abd",
+                                "b",  "ba",  "bab", "bb",  "c"};
+  for (std::size_t i = 0; i != keys.size(); i++) {
+    trie.insert(keys[i], static_cast<int>(i));
+  }
+  std::mt19937 rng(7);
+
+  SECTION("Single keys") {
+    std::map<std::string, std::size_t> drawn{};
+    for (int i = 0; i != 3000; i++) {
+      auto sample = trie.sample("ab", rng);
+      REQUIRE(sample);
+      REQUIRE(sample->first.starts_with("ab"));
+      REQUIRE(*sample->second == *trie.at(sample->first));
+      drawn[sample->first]++;
+    }
+    // every key is drawn about 1000 times
+    REQUIRE(drawn.size() == 3);
+    for (auto &[key, count] : drawn) {
+      REQUIRE(count > 850);
+      REQUIRE(count < 1150);
+    }
+    REQUIRE(trie.sample("c", rng)->first == "c");
+    REQUIRE(!trie.sample("ca", rng));
+    trie.erase("c");
+    // the node of "c" may remain without keys below it
+    REQUIRE(!trie.sample("c", rng));
+  }
+
+  SECTION("Several keys without replacement") {
+    std::map<std::string, std::size_t> drawn{};
+    for (int i = 0; i != 2000; i++) {
+      auto sample = trie.sample("", 4, rng);
+      REQUIRE(sample.size() == 4);
+      for (std::size_t j = 0; j != sample.size(); j++) {
+        REQUIRE(*sample[j].second == *trie.at(sample[j].first));
+        if (j != 0) {
+          REQUIRE(sample[j - 1].first < sample[j].first);
+        }
+        drawn[sample[j].first]++;
+      }
+    }
+    // every key is drawn in about 2000 * 4 / 10 = 800 samples
+    REQUIRE(drawn.size() == keys.size());
+    for (auto &[key, count] : drawn) {
+      REQUIRE(count > 650);
+      REQUIRE(count < 950);
+    }
+
+    std::vector<std::string> all{};
+    for (auto &[key, value] : trie.sample("b", 10, rng)) {
+      all.push_back(key);
+    }
+    REQUIRE(all == std::vector<std::string>{"b", "ba", "bab", "bb"});
+    REQUIRE(trie.sample("b", 0, rng).empty());
+    REQUIRE(trie.sample("x", 3, rng).empty());
+    REQUIRE(trie.sample(std::string_view("ba"), 1, rng).size() == 1);
+  }
+}
+
+TEST_CASE("Merging, intersecting and subtracting tries", "[trie merge]") {
+  auto contents = [](const auto &trie) {
+    std::vector<std::pair<std::string, std::string>> result{};
+    for (auto it = trie.ordered_begin(); it != trie.ordered_end(); ++it) {
+      result.emplace_back(it.key(), it.value());
+    }
+    return result;
+  };
+  auto make = [](std::vector<std::string> keys, const std::string &suffix) {
+    StringStringTrie trie{};
+    for (auto &key : keys) {
+      trie.insert(key, key + suffix);
+    }
+    return trie;
+  };
+  StringStringTrie a = make({"", "a", "ab", "abc", "b", "bcd", "bcde"}, "1");
+  StringStringTrie b = make({"ab", "abd", "b", "bc", "c", "cde"}, "2");
+
+  SECTION("Merging") {
+    a.merge(std::move(b), [](std::string value, std::string other_value) {
+      return value + other_value;
+    });
+    using Entries = std::vector<std::pair<std::string, std::string>>;
+    REQUIRE(contents(a) == Entries{{"", "1"},
+                                   {"a", "a1"},
+                                   {"ab", "ab1ab2"},
+                                   {"abc", "abc1"},
+                                   {"abd", "abd2"},
+                                   {"b", "b1b2"},
+                                   {"bc", "bc2"},
+                                   {"bcd", "bcd1"},
+                                   {"bcde", "bcde1"},
+                                   {"c", "c2"},
+                                   {"cde", "cde2"}});
+    REQUIRE(b.begin() == b.end());
+    REQUIRE(!b.has_key("c"));
+
+    // the spliced nodes are part of a now
+    a.erase("cde");
+    a.erase("c");
+    REQUIRE(a.subtrie_iterator("c") == a.end());
+    a.insert("abde", "abde");
+    REQUIRE(a.at("abde") == "abde");
+    StringStringTrie copy(a);
+    REQUIRE(contents(copy) == contents(a));
+
+    b.insert("z", "z");
+    a.merge(std::move(b), [](std::string, std::string) { return ""; });
+    REQUIRE(a.at("z") == "z");
+    a.merge(StringStringTrie(), [](std::string, std::string) { return ""; });
+    REQUIRE(a.at("bcde") == "bcde1");
+  }
+
+  SECTION("Intersecting and subtracting") {
+    using Entries = std::vector<std::pair<std::string, std::string>>;
+    REQUIRE(contents(intersect(a, b)) == Entries{{"ab", "ab1"}, {"b", "b1"}});
+    REQUIRE(contents(intersect(b, a)) == Entries{{"ab", "ab2"}, {"b", "b2"}});
+    REQUIRE(contents(difference(a, b)) == Entries{{"", "1"},
+                                                  {"a", "a1"},
+                                                  {"abc", "abc1"},
+                                                  {"bcd", "bcd1"},
+                                                  {"bcde", "bcde1"}});
+    REQUIRE(contents(difference(b, a)) == Entries{{"abd", "abd2"},
+                                                  {"bc", "bc2"},
+                                                  {"c", "c2"},
+                                                  {"cde", "cde2"}});
+    REQUIRE(contents(intersect(a, a)) == contents(a));
+    REQUIRE(contents(difference(a, a)).empty());
+    REQUIRE(contents(a).size() == 7);
+
+    StringStringTrie rest = difference(std::move(a), b);
+    rest.erase("bcde");
+    rest.erase("bcd");
+    REQUIRE(rest.subtrie_iterator("b") == rest.end());
+    REQUIRE(contents(rest) ==
+            Entries{{"", "1"}, {"a", "a1"}, {"abc", "abc1"}});
+  }
+
+  SECTION("Other value stores") {
+    using Counted = Trie<std::string, Aggregated<int, CountOf<int>>>;
+    Counted c1{}, c2{};
+    for (std::string key : {"a", "ab", "abc", "b"}) {
+      c1.insert(key, 1);
+    }
+    for (std::string key : {"ab", "abd", "abde", "c"}) {
+      c2.insert(key, 2);
+    }
+    REQUIRE(c1.count_prefix("ab") == 2);
+    REQUIRE(intersect(c1, c2).count_prefix("") == 1);
+    REQUIRE(difference(c1, c2).count_prefix("ab") == 1);
+    REQUIRE(difference(c2, c1).count_prefix("") == 3);
+    c1.merge(std::move(c2), [](int x, int y) { return x + y; });
+    REQUIRE(c1.count_prefix("") == 7);
+    REQUIRE(c1.count_prefix("ab") == 4);
+    REQUIRE(c1.count_prefix("abd") == 2);
+    REQUIRE(c1.aggregate("") == 7);
+    REQUIRE(c1.at("ab") == 3);
+
+    using Detached = Trie<std::string, DetachedValue<int>>;
+    Detached d1{}, d2{};
+    for (std::string key : {"a", "ab", "abc", "b"}) {
+      d1.insert(key, 1);
+    }
+    for (std::string key : {"ab", "abd", "abde", "c"}) {
+      d2.insert(key, 10);
+    }
+    int sum = 0;
+    auto add = [&](int value) { sum += value; };
+    difference(d1, d2).for_each_value(add);
+    REQUIRE(sum == 3);
+    d1.merge(std::move(d2), [](int x, int y) { return x + y; });
+    sum = 0;
+    d1.for_each_value(add);
+    REQUIRE(sum == 44);
+    REQUIRE(d1.at("abde") == 10);
+    REQUIRE(d1.at("ab") == 11);
+    d1.erase("abd");
+    REQUIRE(d1.at("abde") == 10);
+
+    using Rooted = Trie<std::string, int, DummyConverter<std::string>,
+                        MapStorage<std::string, char, int>, 256>;
+    Rooted r1{}, r2{};
+    r1.insert("ab", 1);
+    r2.insert("abc", 2);
+    r2.insert("cd", 3);
+    r2.insert("cde", 4);
+    r1.merge(std::move(r2), [](int x, int) { return x; });
+    REQUIRE(r1.at("abc") == 2);
+    REQUIRE(r1.at("cde") == 4);
+    r1.erase("cde");
+    Rooted cd{};
+    cd.insert("cd", 0);
+    r1 = difference(std::move(r1), cd);
+    REQUIRE(!r1.has_key("cd"));
+    REQUIRE(r1.at("abc") == 2);
+    r1.insert("cd", 5);
+    REQUIRE(r1.at("cd") == 5);
+  }
+}
 /***/
\ No newline at end of file
@@ -16,12 +16,28 @@
 #ifndef TRIE_HPP
 #define TRIE_HPP
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
 #include <cstdlib>
 #include <map>
 #include <memory>
+#include <numeric>
 #include <optional>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 template <typename A, typename B>
 concept same_as_disregard_ref =
@@ -67,6 +83,28 @@ template <NaturallySuitedTrieKeyType KeyType> struct DummyConverter {
   static std::size_t size(const KeyType &key) noexcept {
     return std::size(key);
   }
+
+  // Any other sequence of KeyContents can be read as well, e.g. a
+  // std::string_view for std::string keys or a std::span<const int> for
+  // std::vector<int> keys. This allows lookups without constructing a KeyType.
+  template <typename Sequence>
+  requires(!std::same_as<Sequence, KeyType> && !std::is_array_v<Sequence> &&
+           requires(const Sequence &sequence, std::size_t ind) {
+             { sequence[ind] } -> std::convertible_to<KeyContent>;
+             { std::size(sequence) } -> std::convertible_to<std::size_t>;
+           }) static KeyContent
+      get_at_index(const Sequence &key, const std::size_t ind) {
+    return key[ind];
+  }
+
+  template <typename Sequence>
+  requires(!std::same_as<Sequence, KeyType> && !std::is_array_v<Sequence> &&
+           requires(const Sequence &sequence, std::size_t ind) {
+             { sequence[ind] } -> std::convertible_to<KeyContent>;
+             { std::size(sequence) } -> std::convertible_to<std::size_t>;
+           }) static std::size_t size(const Sequence &key) noexcept {
+    return std::size(key);
+  }
 };
 
 // An example converter that enables ints as keys by interpreting an int as a
@@ -88,6 +126,96 @@ struct IntBitwiseConverter {
   }
 };
 
+#ifdef __SIZEOF_INT128__
+__extension__ typedef __int128 Int128;
+__extension__ typedef unsigned __int128 UInt128;
+#endif
+
+// Describes the integer types that IntStrideConverter supports: all integral
+// types except bool, and the 128-bit integers if the compiler provides them
+// (which std::integral does not include in strict ISO mode).
+template <typename T> struct IntegerKeyTraits;
+
+template <typename T>
+requires(std::integral<T> && !std::same_as<T, bool>) struct IntegerKeyTraits<T> {
+  using unsigned_type = std::make_unsigned_t<T>;
+  static constexpr bool is_signed = std::is_signed_v<T>;
+};
+
+#ifdef __SIZEOF_INT128__
+template <> struct IntegerKeyTraits<Int128> {
+  using unsigned_type = UInt128;
+  static constexpr bool is_signed = true;
+};
+
+template <> struct IntegerKeyTraits<UInt128> {
+  using unsigned_type = UInt128;
+  static constexpr bool is_signed = false;
+};
+#endif
+
+enum class BitOrder { msb_first, lsb_first };
+
+// A converter for integer keys that reads stride bits per symbol, so that
+// e.g. a std::uint64_t with stride 8 is a sequence of 8 bytes instead of 64
+// bits. With BitOrder::msb_first, keys are enumerated in numeric order by
+// Trie::ordered_begin() (signed keys have their sign bit flipped, so that
+// negative keys come first). Symbols are smaller than alphabet_size, which is
+// the size to use with ArrayStorage or HybridStorage.
+template <typename T, std::size_t stride = 8,
+          BitOrder order = BitOrder::msb_first>
+requires(stride == 1 || stride == 2 || stride == 4 || stride == 8 ||
+         stride == 16) struct IntStrideConverter {
+  using KeyContent =
+      std::conditional_t<stride <= 8, std::uint8_t, std::uint16_t>;
+
+  static constexpr std::size_t alphabet_size = std::size_t{1} << stride;
+
+  static KeyContent get_at_index(const T &key, const std::size_t ind) noexcept {
+    using Unsigned = typename IntegerKeyTraits<T>::unsigned_type;
+    Unsigned bits = static_cast<Unsigned>(key);
+    if constexpr (IntegerKeyTraits<T>::is_signed) {
+      bits ^= Unsigned{1} << (key_bits - 1);
+    }
+    std::size_t shift = order == BitOrder::msb_first
+                            ? (key_bits / stride - 1 - ind) * stride
+                            : ind * stride;
+    return static_cast<KeyContent>((bits >> shift) & (alphabet_size - 1));
+  }
+
+  static std::size_t size(const T &) noexcept { return key_bits / stride; }
+
+private:
+  static constexpr std::size_t key_bits = sizeof(T) * 8;
+};
+
+// The first length bits of an unsigned integer, most significant bit first.
+// For example, the IPv4 route 10.0.0.0/8 is
+// BitPrefix<std::uint32_t>{0x0a000000, 8}, and an address to be routed is a
+// BitPrefix of full length. Bits after
+// the prefix should be zero, so that equal prefixes compare equal.
+template <std::unsigned_integral T> struct BitPrefix {
+  T bits;
+  std::uint8_t length;
+
+  bool operator==(const BitPrefix &other) const = default;
+};
+
+// A converter for BitPrefix keys: the symbols are the bits of the prefix.
+// Unlike with IntBitwiseConverter, the most significant bit comes first, so
+// that Trie::longest_prefix_match finds the most specific route of an address.
+template <std::unsigned_integral T> struct BitPrefixConverter {
+  using KeyContent = bool;
+  static KeyContent get_at_index(const BitPrefix<T> &key,
+                                 const std::size_t ind) noexcept {
+    return (key.bits >> (std::numeric_limits<T>::digits - 1 - ind)) & 1;
+  }
+
+  static std::size_t size(const BitPrefix<T> &key) noexcept {
+    return key.length;
+  }
+};
+
 // A converter lets the trie view some object as a sequence of symbols.
 // It must provide methods to acquire the symbol at a certain position and the
 // key's size. Further it must provide the data-type that symbols have
@@ -103,6 +231,390 @@ concept ConverterType = requires(const KeyType &key, const std::size_t ind) {
   ->std::same_as<typename C::KeyContent>;
 };
 
+// Use DetachedValue<T> as the ValueType of a trie to store values of type T
+// outside of the trie's nodes: Every node only holds a 32-bit index
+// (ValueSlot), while values and keys are kept in separate dense containers
+// owned by the trie. This keeps nodes small when T is large (most nodes are
+// interior nodes without a value), and lets the trie sweep over all values
+// without touching a single node (see Trie::for_each_value()).
+template <typename T> struct DetachedValue {};
+
+// The slot index that a node uses with DetachedValue.
+struct ValueSlot {
+  static constexpr std::uint32_t none = UINT32_MAX;
+
+  bool has_value() const noexcept { return index != none; }
+
+  std::uint32_t index = none;
+};
+
+// A Monoid combines the values of type T in a subtrie into one aggregate:
+// value_type: the type of aggregates.
+// identity(): the aggregate of no values.
+// lift(value): the aggregate of a single value.
+// combine(a, b): the aggregate of the values of a followed by those of b. It
+// must be associative, and identity() must be neutral.
+template <typename M, typename T>
+concept MonoidType = requires(const T &value,
+                              const typename M::value_type &aggregate) {
+  { M::identity() }
+  ->std::convertible_to<typename M::value_type>;
+  { M::lift(value) }
+  ->std::convertible_to<typename M::value_type>;
+  { M::combine(aggregate, aggregate) }
+  ->std::convertible_to<typename M::value_type>;
+};
+
+// Use Aggregated<T, Monoid> as the ValueType of a trie to store values of
+// type T together with, in every node, the aggregate of all values in the
+// node's subtrie (e.g. their maximum with MaxOf<T>). See AggregatingValueStore.
+template <typename T, MonoidType<T> Monoid> struct Aggregated {};
+
+// Keeps the largest value, e.g. for Trie::top_k().
+template <typename T> struct MaxOf {
+  using value_type = T;
+
+  static T identity() { return std::numeric_limits<T>::lowest(); }
+
+  static T lift(const T &value) { return value; }
+
+  static T combine(const T &a, const T &b) { return std::max(a, b); }
+};
+
+// Keeps the smallest value.
+template <typename T> struct MinOf {
+  using value_type = T;
+
+  static T identity() { return std::numeric_limits<T>::max(); }
+
+  static T lift(const T &value) { return value; }
+
+  static T combine(const T &a, const T &b) { return std::min(a, b); }
+};
+
+// Keeps the sum of the values.
+template <typename T> struct SumOf {
+  using value_type = T;
+
+  static T identity() { return T(); }
+
+  static T lift(const T &value) { return value; }
+
+  static T combine(const T &a, const T &b) { return a + b; }
+};
+
+// Counts the values, for Trie::count_prefix(), rank() and select().
+template <typename T> struct CountOf {
+  using value_type = std::size_t;
+
+  static std::size_t identity() { return 0; }
+
+  static std::size_t lift(const T &) { return 1; }
+
+  static std::size_t combine(std::size_t a, std::size_t b) { return a + b; }
+
+  // Monoids that provide count() can be used for counting.
+  static std::size_t count(std::size_t aggregate) { return aggregate; }
+};
+
+// The slot that a node uses with Aggregated.
+template <typename T, typename Monoid> struct AggregateSlot {
+  bool has_value() const noexcept { return value.has_value(); }
+
+  std::optional<T> value;
+  // The aggregate of the subtrie, unless dirty is set.
+  typename Monoid::value_type aggregate = Monoid::identity();
+  bool dirty = false;
+};
+
+// Placeholder for members that are not needed with some ValueTypes.
+struct Omitted {};
+
+// Marks the nodes of a TrieSet that correspond to a key in the set.
+struct TerminalFlag {
+  bool has_value() const noexcept { return terminal; }
+
+  bool terminal = false;
+};
+
+// Stores values inside the nodes. This is the default.
+template <typename KeyType, typename ValueType, typename Node>
+class InlineValueStore {
+public:
+  bool has_value(const Node *node) const noexcept {
+    return node->elem.has_value();
+  }
+
+  std::optional<ValueType> &value(Node *node) noexcept { return node->elem; }
+
+  const std::optional<ValueType> &value(const Node *node) const noexcept {
+    return node->elem;
+  }
+
+  const KeyType &key(const Node *node) const { return node->key.value(); }
+
+  void set_key(Node *node, const KeyType &key) { node->key = key; }
+
+  void set_key(Node *node, KeyType &&key) { node->key = std::move(key); }
+
+  // Called before a node is deleted or when its key is removed.
+  void release(Node *node) noexcept { node->key.reset(); }
+
+  // Called after the subtrie of node was moved over from the trie of another
+  // store. Values and keys are in the nodes, so they came along.
+  void adopt(Node *, InlineValueStore &) noexcept {}
+
+  template <typename F> void for_each_value(Node *node, F &f) {
+    if (node->elem.has_value()) {
+      f(*node->elem);
+    }
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      if (*it) {
+        for_each_value((*it).get(), f);
+      }
+    }
+  }
+};
+
+// Stores values and keys in deques indexed by the nodes' ValueSlots. A deque
+// is used so that references to values stay valid when other values are
+// added. Slots of erased keys are reused.
+template <typename KeyType, typename ValueType, typename Node>
+class DetachedValueStore {
+public:
+  bool has_value(const Node *node) const noexcept {
+    return node->elem.has_value() && values[node->elem.index].has_value();
+  }
+
+  std::optional<ValueType> &value(Node *node) {
+    return values[slot(node)];
+  }
+
+  // Only for nodes with a value.
+  const std::optional<ValueType> &value(const Node *node) const {
+    return values[node->elem.index];
+  }
+
+  const KeyType &key(const Node *node) const {
+    return keys[node->elem.index];
+  }
+
+  void set_key(Node *node, const KeyType &key) { keys[slot(node)] = key; }
+
+  void set_key(Node *node, KeyType &&key) {
+    keys[slot(node)] = std::move(key);
+  }
+
+  void release(Node *node) {
+    if (node->elem.has_value()) {
+      values[node->elem.index].reset();
+      free_slots.push_back(node->elem.index);
+      node->elem.index = ValueSlot::none;
+    }
+  }
+
+  // Moves the values and keys of the subtrie of node, which was moved over
+  // from the trie of another store, into slots of this store.
+  void adopt(Node *node, DetachedValueStore &from) {
+    if (node->elem.has_value()) {
+      std::uint32_t index = node->elem.index;
+      node->elem.index = ValueSlot::none;
+      std::uint32_t new_index = slot(node);
+      values[new_index] = std::move(from.values[index]);
+      keys[new_index] = std::move(from.keys[index]);
+      from.values[index].reset();
+      from.free_slots.push_back(index);
+    }
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      if (*it) {
+        adopt((*it).get(), from);
+      }
+    }
+  }
+
+  template <typename F> void for_each_value(Node *, F &f) {
+    for (std::optional<ValueType> &value : values) {
+      if (value.has_value()) {
+        f(*value);
+      }
+    }
+  }
+
+private:
+  std::uint32_t slot(Node *node) {
+    if (node->elem.has_value()) {
+      return node->elem.index;
+    }
+    if (!free_slots.empty()) {
+      node->elem.index = free_slots.back();
+      free_slots.pop_back();
+    } else {
+      assert(values.size() < ValueSlot::none);
+      node->elem.index = static_cast<std::uint32_t>(values.size());
+      values.emplace_back();
+      keys.emplace_back();
+    }
+    return node->elem.index;
+  }
+
+  std::deque<std::optional<ValueType>> values;
+  std::deque<KeyType> keys;
+  std::vector<std::uint32_t> free_slots;
+};
+
+// Stores values inside the nodes, like InlineValueStore, and maintains the
+// aggregates of Aggregated<T, Monoid> lazily: Every access that may write a
+// value marks the node and its ancestors as dirty, and aggregate() recomputes
+// dirty nodes from their children when it is asked for them. Since the
+// ancestors of a dirty node are dirty as well, marking stops at the first
+// node that already is, and a clean node's aggregate is up to date.
+// Accesses through const tries and at() only read and keep aggregates clean.
+template <typename KeyType, typename T, typename Monoid, typename Node>
+class AggregatingValueStore {
+public:
+  using monoid_type = Monoid;
+
+  bool has_value(const Node *node) const noexcept {
+    return node->elem.has_value();
+  }
+
+  std::optional<T> &value(Node *node) noexcept {
+    invalidate(node);
+    return node->elem.value;
+  }
+
+  const std::optional<T> &value(const Node *node) const noexcept {
+    return node->elem.value;
+  }
+
+  const KeyType &key(const Node *node) const { return node->key.value(); }
+
+  void set_key(Node *node, const KeyType &key) { node->key = key; }
+
+  void set_key(Node *node, KeyType &&key) { node->key = std::move(key); }
+
+  // Called before a node is deleted or when its key is removed.
+  void release(Node *node) noexcept {
+    invalidate(node);
+    node->key.reset();
+  }
+
+  // The aggregates of a subtrie moved over from another trie are still
+  // valid; only those of its new ancestors change.
+  void adopt(Node *node, AggregatingValueStore &) noexcept {
+    invalidate(node->parent);
+  }
+
+  template <typename F> void for_each_value(Node *node, F &f) {
+    if (node->elem.has_value()) {
+      f(*value(node));
+    }
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      if (*it) {
+        for_each_value((*it).get(), f);
+      }
+    }
+  }
+
+  // Returns the aggregate of all values in the subtrie of node: its own value
+  // followed by the subtries of its children in the order of the storage.
+  const typename Monoid::value_type &aggregate(Node *node) const {
+    if (node->elem.dirty) {
+      typename Monoid::value_type result =
+          node->elem.value ? Monoid::lift(*node->elem.value)
+                           : Monoid::identity();
+      for (auto it = node->children.begin(); it != node->children.end();
+           ++it) {
+        if (*it) {
+          result = Monoid::combine(result, aggregate((*it).get()));
+        }
+      }
+      node->elem.aggregate = std::move(result);
+      node->elem.dirty = false;
+    }
+    return node->elem.aggregate;
+  }
+
+private:
+  static void invalidate(Node *node) noexcept {
+    while (node && !node->elem.dirty) {
+      node->elem.dirty = true;
+      node = node->parent;
+    }
+  }
+};
+
+// The ValueStore of a trie with ValueType Aggregated<T, Monoid>.
+template <typename Store, typename Node>
+concept AggregatingStoreType = requires(const Store &store, Node *node) {
+  typename Store::monoid_type;
+  store.aggregate(node);
+};
+
+// The ValueStore of a trie whose aggregates include the number of values.
+template <typename Store, typename Node>
+concept CountingStoreType =
+    AggregatingStoreType<Store, Node> &&
+    requires(const Store &store, Node *node) {
+  { Store::monoid_type::count(store.aggregate(node)) }
+  ->std::convertible_to<std::size_t>;
+};
+
+// Describes how a trie stores the values of type ValueType:
+// mapped_type: the type of the values as seen by users of the trie.
+// slot_type / key_slot_type: the types of TrieNode::elem and TrieNode::key.
+// store_type: the type of the object that the trie uses to access values and
+// keys of nodes.
+template <typename KeyType, typename ValueType> struct TrieValueTraits {
+  using mapped_type = ValueType;
+  using slot_type = std::optional<ValueType>;
+  using key_slot_type = std::optional<KeyType>;
+  template <typename Node>
+  using store_type = InlineValueStore<KeyType, ValueType, Node>;
+};
+
+template <typename KeyType, typename T>
+struct TrieValueTraits<KeyType, DetachedValue<T>> {
+  using mapped_type = T;
+  using slot_type = ValueSlot;
+  using key_slot_type = Omitted;
+  template <typename Node>
+  using store_type = DetachedValueStore<KeyType, T, Node>;
+};
+
+template <typename KeyType, typename T, typename Monoid>
+struct TrieValueTraits<KeyType, Aggregated<T, Monoid>> {
+  using mapped_type = T;
+  using slot_type = AggregateSlot<T, Monoid>;
+  using key_slot_type = std::optional<KeyType>;
+  template <typename Node>
+  using store_type = AggregatingValueStore<KeyType, T, Monoid, Node>;
+};
+
+// Used by TrieSet: Nodes don't store values or keys, only a terminal flag.
+template <typename KeyType> struct TrieValueTraits<KeyType, void> {
+  using mapped_type = void;
+  using slot_type = TerminalFlag;
+  using key_slot_type = Omitted;
+};
+
+// A key that can be used to look up keys of type KeyType in a trie without
+// being a KeyType itself, because Converter can read its symbols.
+template <typename K, typename KeyType, typename Converter>
+concept HeterogeneousKey =
+    !std::same_as<std::remove_cvref_t<K>, KeyType> &&
+    !std::is_array_v<std::remove_cvref_t<K>> && ConverterType<Converter, K>;
+
+// Null-terminated strings can be used for lookups if the Converter can read a
+// std::basic_string_view of the symbol type.
+template <typename KeyContent, typename Converter>
+concept CStringKeyContent =
+    (std::same_as<KeyContent, char> || std::same_as<KeyContent, wchar_t> ||
+     std::same_as<KeyContent, char8_t> || std::same_as<KeyContent, char16_t> ||
+     std::same_as<KeyContent, char32_t>)&&ConverterType<Converter,
+                                                         std::basic_string_view<
+                                                             KeyContent>>;
+
 template <typename KeyType, typename KeyContent, typename ValueType,
           typename StorageType>
 struct TrieNode {
@@ -110,14 +622,14 @@ struct TrieNode {
       TrieNode<KeyType, KeyContent, ValueType, StorageType>;
 
   TrieNode(TrieNode_instance *parent, KeyContent prefixed_by)
-      : elem(), key(), children(), parent(parent), prefixed_by(prefixed_by) {}
+      : children(), parent(parent), prefixed_by(prefixed_by), elem(), key() {}
 
   TrieNode(const TrieNode_instance &other)
       : TrieNode_instance(other, (TrieNode_instance *)nullptr) {}
 
   TrieNode(const TrieNode_instance &other, TrieNode_instance *parent)
-      : elem(other.elem), key(other.key), children(other.children, this),
-        parent(parent), prefixed_by(other.prefixed_by) {}
+      : children(other.children, this), parent(parent),
+        prefixed_by(other.prefixed_by), elem(other.elem), key(other.key) {}
 
   ~TrieNode() {}
 
@@ -125,11 +637,14 @@ struct TrieNode {
 
   bool has_child(KeyContent &ind) const { return children.has_child(ind); }
 
-  std::optional<ValueType> elem;
-  std::optional<KeyType> key;
   StorageType children;
   TrieNode_instance *parent;
   KeyContent prefixed_by;
+  // elem is placed after prefixed_by, so that small slots (like the
+  // TerminalFlag of a TrieSet) fill the padding after it.
+  typename TrieValueTraits<KeyType, ValueType>::slot_type elem;
+  [[no_unique_address]]
+  typename TrieValueTraits<KeyType, ValueType>::key_slot_type key;
 };
 
 // A StorageType is a type that a TrieNode can use to store pointers to its
@@ -176,6 +691,18 @@ concept StorageType =
   { *storage.find(keycont) }
   ->same_as_disregard_ref<
       std::shared_ptr<TrieNode<KeyType, KeyContent, ValueType, ST>>>;
+
+  // removes the child for a given symbol (if there is one).
+  storage.erase(keycont);
+};
+
+// A StorageType that enumerates children in the order of their symbols and can
+// start at the first child whose symbol is not less than a given one. Tries
+// using such a storage support lookups in key order (Trie::lower_bound etc.).
+template <typename ST, typename KeyContent>
+concept OrderedStorageType = requires(ST &storage, KeyContent keycont) {
+  { storage.lower_bound(keycont) }
+  ->std::same_as<decltype(storage.begin())>;
 };
 
 // A StorageType using std::map.
@@ -211,6 +738,8 @@ public:
     return children[key];
   }
 
+  void erase(KeyContent key) noexcept { children.erase(key); }
+
   // Custom iterator needed since std::map<..>::iterator iterates over key-value
   // pairs (while we want to iterate over values only).
   class Iterator {
@@ -227,7 +756,7 @@ public:
     }
     bool operator!=(const Iterator &other) noexcept { return it != other.it; }
 
-    std::shared_ptr<TrieNode_instance> operator*() {
+    std::shared_ptr<TrieNode_instance> &operator*() {
       // no bounds check necessary because we only use this function internally
       // and guarantee that no UB can occur.
       return it->second;
@@ -248,6 +777,10 @@ public:
     return Iterator(children.find(ind), children.end());
   }
 
+  Iterator lower_bound(KeyContent ind) noexcept {
+    return Iterator(children.lower_bound(ind), children.end());
+  }
+
 private:
   InternalStorageType children;
 };
@@ -285,6 +818,8 @@ public:
     return children[key];
   }
 
+  void erase(KeyContent key) noexcept { children.erase(key); }
+
   class Iterator {
   public:
     Iterator(typename InternalStorageType::iterator it,
@@ -299,7 +834,7 @@ public:
     }
     bool operator!=(const Iterator &other) noexcept { return it != other.it; }
 
-    std::shared_ptr<TrieNode_instance> operator*() {
+    std::shared_ptr<TrieNode_instance> &operator*() {
       // no bounds check necessary because we only use this function internally
       // and guarantee that no UB can occur.
       return it->second;
@@ -367,6 +902,10 @@ public:
     return children.at(static_cast<std::size_t>(key));
   }
 
+  void erase(KeyContent key) {
+    children.at(static_cast<std::size_t>(key)).reset();
+  }
+
   // No custom iterator type that performs bounds checking needed: We are
   // certain that invalid iterators are never dereferenced, because we only use
   // them internally (Trie::leftmost_bottommost_node()).
@@ -380,258 +919,2670 @@ public:
     return &children.at(static_cast<std::size_t>(key));
   }
 
+  // Like begin(), the result may point to an empty slot.
+  std::shared_ptr<TrieNode_instance> *lower_bound(KeyContent key) {
+    return &children.at(static_cast<std::size_t>(key));
+  }
+
 private:
   InternalStorageType children;
 };
 
-// KeyType: Type of Key
-// ValueType: Type of values
-// Converter: Provides functions to get symbols in the key at specific
-// positions and the key's size. If none is specified, operator[] and
-// std::size() are used. Must adhere to concept ConverterType<KeyType>.
-// Storage: The type of storage to use. Default: MapStorage. Must adhere to
-// concept StorageType<KeyType, Converter::KeyContent, ValueType>.
-template <
-    typename KeyType, typename ValueType,
-    ConverterType<KeyType> Converter = DummyConverter<KeyType>,
-    StorageType<KeyType, typename Converter::KeyContent, ValueType> Storage =
-        MapStorage<KeyType, typename Converter::KeyContent, ValueType>>
-class Trie {
-private:
-  using KeyContent = typename Converter::KeyContent;
-  using TrieNode_instance = TrieNode<KeyType, KeyContent, ValueType, Storage>;
-
+// A StorageType that switches between a sorted vector of (symbol, child)
+// pairs and a direct-indexed std::array depending on the number of children.
+// Sparse nodes (the vast majority of nodes in a word trie) only pay for a
+// small vector, while dense nodes (typically the first levels) get the lookup
+// performance of an ArrayStorage.
+// A node is promoted to an array as soon as it has more than promote_at
+// children and demoted back to a vector as soon as erasures leave it with
+// fewer than demote_at children. Choosing demote_at < promote_at avoids
+// thrashing between both representations.
+// The template-parameter size has the same meaning as for ArrayStorage.
+template <typename KeyType, std::convertible_to<std::size_t> KeyContent,
+          typename ValueType, std::size_t size, std::size_t promote_at = 16,
+          std::size_t demote_at = promote_at / 2>
+requires(demote_at <= promote_at) class HybridStorage {
 public:
-  class Iterator;
-
-  Trie() : root(std::make_shared<TrieNode_instance>(nullptr, KeyContent{})) {}
-
-  Trie(const Trie &trie)
-      : root(std::make_shared<TrieNode_instance>(*trie.root)) {}
+  using TrieNode_instance =
+      TrieNode<KeyType, KeyContent, ValueType,
+               HybridStorage<KeyType, KeyContent, ValueType, size, promote_at,
+                             demote_at>>;
+  using Entry = std::pair<KeyContent, std::shared_ptr<TrieNode_instance>>;
+  using DenseStorageType =
+      std::array<std::shared_ptr<TrieNode_instance>, size>;
 
-  Trie(Trie &&other) { swap(*this, other); }
+  HybridStorage() : sparse(), dense(), dense_count(0) {}
 
-  ~Trie() {}
+  HybridStorage(const HybridStorage &other, TrieNode_instance *parent)
+      : sparse(), dense(), dense_count(other.dense_count) {
+    if (other.dense) {
+      dense = std::make_unique<DenseStorageType>();
+      for (std::size_t i = 0; i < size; ++i) {
+        if ((*other.dense)[i]) {
+          (*dense)[i] =
+              std::make_shared<TrieNode_instance>(*(*other.dense)[i], parent);
+        }
+      }
+      return;
+    }
+    sparse.reserve(other.sparse.size());
+    for (const Entry &entry : other.sparse) {
+      sparse.emplace_back(entry.first, std::make_shared<TrieNode_instance>(
+                                           *entry.second, parent));
+    }
+  }
 
-  friend void swap(Trie &t1, Trie &t2) { std::swap(t1.root, t2.root); }
+  ~HybridStorage() {}
 
-  Trie &operator=(const Trie &other) { return *this = Trie(other); }
+  HybridStorage &operator=(const HybridStorage &other) = delete;
 
-  Trie &operator=(Trie &&other) {
-    swap(*this, other);
-    return *this;
+  bool has_child(KeyContent key) const {
+    if (dense) {
+      return dense->at(static_cast<std::size_t>(key)) != nullptr;
+    }
+    auto it = sparse_position(sparse, key);
+    return it != sparse.end() && it->first == key;
   }
 
-  // Inserts a key-value pair into the trie.
-  // If the given key is already associated with a value,
-  // then this old value is overridden with the new value.
-  // This method returns an optional that contains the
-  // value previously associated with the given key, or an empty one
-  // if there is no such value.
-  std::optional<ValueType> insert(const KeyType key,
-                                  const ValueType to_insert) {
-    std::shared_ptr<TrieNode_instance> insert_at_node = mk_path_to_node(key);
-    std::optional to_insert_o(to_insert);
-    insert_at_node->elem.swap(to_insert_o);
-    return to_insert_o;
+  // Like std::map::operator[], this creates an (empty) entry for the symbol if
+  // there is none. This may promote the storage to its dense representation.
+  std::shared_ptr<TrieNode_instance> &operator[](KeyContent key) {
+    if (dense) {
+      std::shared_ptr<TrieNode_instance> &slot =
+          dense->at(static_cast<std::size_t>(key));
+      if (!slot) {
+        ++dense_count;
+      }
+      return slot;
+    }
+    auto it = sparse_position(sparse, key);
+    if (it != sparse.end() && it->first == key) {
+      return it->second;
+    }
+    if (sparse.size() < promote_at) {
+      return sparse.emplace(it, key, nullptr)->second;
+    }
+    promote();
+    ++dense_count;
+    return dense->at(static_cast<std::size_t>(key));
   }
 
-  std::optional<ValueType> at(KeyType &key) const {
-    std::shared_ptr<TrieNode_instance> current_node = find_node(key);
-    return current_node ? current_node->elem : std::optional<ValueType>();
+  void erase(KeyContent key) {
+    if (!dense) {
+      auto it = sparse_position(sparse, key);
+      if (it != sparse.end() && it->first == key) {
+        sparse.erase(it);
+      }
+      return;
+    }
+    std::shared_ptr<TrieNode_instance> &slot =
+        dense->at(static_cast<std::size_t>(key));
+    if (!slot) {
+      return;
+    }
+    slot.reset();
+    if (--dense_count < demote_at) {
+      demote();
+    }
   }
 
-  std::optional<ValueType> at(KeyType &&key) const {
-    std::shared_ptr<TrieNode_instance> current_node = find_node(key);
-    return current_node ? current_node->elem : std::optional<ValueType>();
-  }
+  // Iterates over the children in the order of their symbols. Unlike the
+  // iterator of ArrayStorage, empty slots of the dense representation are
+  // skipped.
+  class Iterator {
+  public:
+    Iterator(Entry *entry) : entry(entry), slot(nullptr), slot_end(nullptr) {}
 
-  std::optional<ValueType> &operator[](KeyType key) {
-    std::shared_ptr<TrieNode_instance> insert_at_node = mk_path_to_node(key);
-    return insert_at_node->elem;
-  }
+    Iterator(std::shared_ptr<TrieNode_instance> *slot,
+             std::shared_ptr<TrieNode_instance> *slot_end)
+        : entry(nullptr), slot(skip_empty(slot, slot_end)),
+          slot_end(slot_end) {}
 
-  bool has_key(const KeyType &key) const {
-    std::shared_ptr<TrieNode_instance> target_node = find_node(key);
-    return target_node && target_node->elem.has_value();
-  }
+    Iterator &operator++() noexcept {
+      // no bounds check necessary because we only use this function internally
+      // and guarantee that no UB can occur.
+      if (slot) {
+        slot = skip_empty(slot + 1, slot_end);
+      } else {
+        ++entry;
+      }
+      return *this;
+    }
 
-  Iterator begin() { return Iterator(root); }
+    bool operator!=(const Iterator &other) const noexcept {
+      return entry != other.entry || slot != other.slot;
+    }
 
-  Iterator end() { return Iterator(); }
+    std::shared_ptr<TrieNode_instance> &operator*() noexcept {
+      return slot ? *slot : entry->second;
+    }
 
-  // note that this also works if there is no node with the given prefix.
-  Iterator subtrie_iterator(const KeyType &prefix) const {
-    std::shared_ptr<TrieNode_instance> subroot = find_node(prefix);
-    return Iterator(subroot);
+  private:
+    static std::shared_ptr<TrieNode_instance> *
+    skip_empty(std::shared_ptr<TrieNode_instance> *slot,
+               std::shared_ptr<TrieNode_instance> *slot_end) noexcept {
+      while (slot != slot_end && !*slot) {
+        ++slot;
+      }
+      return slot;
+    }
+
+    Entry *entry;
+    std::shared_ptr<TrieNode_instance> *slot;
+    std::shared_ptr<TrieNode_instance> *slot_end;
+  };
+
+  Iterator begin() noexcept {
+    return dense ? Iterator(dense->begin(), dense->end())
+                 : Iterator(sparse.data());
   }
 
-  Iterator subtrie_iterator(const KeyType &&prefix) const {
-    std::shared_ptr<TrieNode_instance> subroot = find_node(prefix);
-    return Iterator(subroot);
+  Iterator end() noexcept {
+    return dense ? Iterator(dense->end(), dense->end())
+                 : Iterator(sparse.data() + sparse.size());
   }
 
-  Iterator subtrie_iterator(const KeyType &prefix, std::size_t len) const {
-    std::shared_ptr<TrieNode_instance> subroot = find_node(prefix, len);
-    return Iterator(subroot);
+  Iterator find(KeyContent key) {
+    if (dense) {
+      return Iterator(&dense->at(static_cast<std::size_t>(key)), dense->end());
+    }
+    auto it = sparse_position(sparse, key);
+    return (it != sparse.end() && it->first == key)
+               ? Iterator(sparse.data() + (it - sparse.begin()))
+               : end();
   }
 
-  Iterator subtrie_iterator(const KeyType &&prefix, std::size_t len) const {
-    std::shared_ptr<TrieNode_instance> subroot = find_node(prefix, len);
-    return Iterator(subroot);
+  Iterator lower_bound(KeyContent key) {
+    if (dense) {
+      return Iterator(&dense->at(static_cast<std::size_t>(key)), dense->end());
+    }
+    return Iterator(sparse.data() +
+                    (sparse_position(sparse, key) - sparse.begin()));
   }
 
-  class Iterator {
-    friend class Trie<KeyType, ValueType, Converter, Storage>;
+  bool is_dense() const noexcept { return dense != nullptr; }
+
+private:
+  // Position of the first entry whose symbol is not less than key, using the
+  // same order as the dense representation. There are at most promote_at
+  // entries, so a linear scan beats a binary search here.
+  template <typename Entries>
+  static auto sparse_position(Entries &entries, KeyContent key) noexcept {
+    auto it = entries.begin();
+    while (it != entries.end() && static_cast<std::size_t>(it->first) <
+                                      static_cast<std::size_t>(key)) {
+      ++it;
+    }
+    return it;
+  }
+
+  void promote() {
+    dense = std::make_unique<DenseStorageType>();
+    for (Entry &entry : sparse) {
+      dense->at(static_cast<std::size_t>(entry.first)) =
+          std::move(entry.second);
+    }
+    dense_count = sparse.size();
+    std::vector<Entry>().swap(sparse);
+  }
+
+  void demote() {
+    sparse.reserve(dense_count);
+    for (std::size_t i = 0; i < size; ++i) {
+      if ((*dense)[i]) {
+        sparse.emplace_back((*dense)[i]->prefixed_by, std::move((*dense)[i]));
+      }
+    }
+    dense.reset();
+    dense_count = 0;
+  }
+
+  std::vector<Entry> sparse;
+  std::unique_ptr<DenseStorageType> dense;
+  // Number of children while the dense representation is in use.
+  std::size_t dense_count;
+};
+
+// A monotonic memory arena. All allocations are served from one contiguous
+// block (plus overflow blocks if the initial estimate was too small) and
+// memory is only released when the arena itself is destroyed.
+// Used by Trie::compact() to place the nodes of a trie next to each other.
+class NodeArena {
+public:
+  // The first block is sized to fit expected_allocations allocations of the
+  // size of the first request.
+  explicit NodeArena(std::size_t expected_allocations)
+      : expected_allocations(expected_allocations), blocks(), current(nullptr),
+        remaining(0) {}
+
+  NodeArena(const NodeArena &other) = delete;
+  NodeArena &operator=(const NodeArena &other) = delete;
+
+  void *allocate(std::size_t bytes, std::size_t alignment) {
+    void *result = std::align(alignment, bytes, current, remaining);
+    if (!result) {
+      std::size_t block_size =
+          (blocks.empty() ? std::max<std::size_t>(expected_allocations, 1)
+                          : expected_allocations / 4 + 1) *
+          (bytes + alignment);
+      blocks.push_back(std::make_unique<std::byte[]>(block_size));
+      current = blocks.back().get();
+      remaining = block_size;
+      result = std::align(alignment, bytes, current, remaining);
+    }
+    current = static_cast<std::byte *>(current) + bytes;
+    remaining -= bytes;
+    return result;
+  }
+
+private:
+  std::size_t expected_allocations;
+  std::vector<std::unique_ptr<std::byte[]>> blocks;
+  void *current;
+  std::size_t remaining;
+};
+
+// An allocator handing out memory from a NodeArena. Deallocation is a no-op.
+// Since every copy of the allocator shares ownership of the arena, the arena
+// lives as long as any object allocated from it.
+template <typename T> struct NodeArenaAllocator {
+  using value_type = T;
+
+  explicit NodeArenaAllocator(std::shared_ptr<NodeArena> arena)
+      : arena(std::move(arena)) {}
+
+  template <typename U>
+  NodeArenaAllocator(const NodeArenaAllocator<U> &other) : arena(other.arena) {}
+
+  T *allocate(std::size_t n) {
+    return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *, std::size_t) noexcept {}
+
+  template <typename U>
+  bool operator==(const NodeArenaAllocator<U> &other) const noexcept {
+    return arena == other.arena;
+  }
+
+  std::shared_ptr<NodeArena> arena;
+};
+
+// A pattern that whole keys are matched against (see Trie::pattern_search()),
+// compiled to a nondeterministic finite automaton over the symbols of keys.
+// Patterns are given as sequences of symbols in one of two syntaxes:
+// glob: ? matches any symbol, * any sequence of symbols, [...] one of a set of
+// symbols, and \ makes the next symbol literal.
+// regex: . matches any symbol, [...] one of a set, and \ makes the next symbol
+// literal; (...) groups, | separates alternatives, and a postfix *, + or ?
+// repeats the preceding item zero or more times, once or more, or at most
+// once.
+// In sets, a-b is a range of symbols, and a leading ^ negates the set.
+// Malformed patterns throw std::invalid_argument.
+template <typename Symbol> class KeyPattern {
+public:
+  static KeyPattern glob(std::basic_string_view<Symbol> pattern) {
+    KeyPattern compiled;
+    Fragment whole = compiled.empty_fragment();
+    for (std::size_t pos = 0; pos != pattern.size();) {
+      Fragment item;
+      if (pattern[pos] == Symbol('*')) {
+        pos++;
+        item = compiled.star(compiled.symbols({}, true));
+      } else if (pattern[pos] == Symbol('?')) {
+        pos++;
+        item = compiled.symbols({}, true);
+      } else {
+        item = compiled.parse_symbol(pattern, pos);
+      }
+      whole = compiled.concatenate(whole, item);
+    }
+    compiled.start = whole.start;
+    compiled.accept = whole.end;
+    return compiled;
+  }
+
+  static KeyPattern regex(std::basic_string_view<Symbol> pattern) {
+    KeyPattern compiled;
+    std::size_t pos = 0;
+    Fragment whole = compiled.parse_alternatives(pattern, pos);
+    if (pos != pattern.size()) {
+      throw std::invalid_argument("unbalanced ) in pattern");
+    }
+    compiled.start = whole.start;
+    compiled.accept = whole.end;
+    return compiled;
+  }
+
+  // Runs the automaton as a DFA whose states are built on demand: every set
+  // of NFA states that is reached gets a number, and transitions between the
+  // numbered sets are cached.
+  class Matcher {
+  public:
+    static constexpr std::uint32_t dead = 0;
+
+    explicit Matcher(const KeyPattern &pattern)
+        : pattern(pattern), ids(), sets(), accepting(), transitions() {
+      add_set({});
+      std::vector<std::uint32_t> initial;
+      pattern.add_closure(pattern.start, initial);
+      start_state = add_set(std::move(initial));
+    }
+
+    std::uint32_t start() const noexcept { return start_state; }
+
+    bool accepts(std::uint32_t state) const { return accepting[state]; }
+
+    std::uint32_t step(std::uint32_t state, Symbol symbol) {
+      if (state == dead) {
+        return dead;
+      }
+      auto cached = transitions[state].find(symbol);
+      if (cached != transitions[state].end()) {
+        return cached->second;
+      }
+      std::vector<std::uint32_t> next;
+      for (std::uint32_t nfa_state : sets[state]) {
+        const State &s = pattern.states[nfa_state];
+        if (s.kind == State::symbols && s.matches(symbol)) {
+          pattern.add_closure(s.out, next);
+        }
+      }
+      std::uint32_t target = add_set(std::move(next));
+      transitions[state].emplace(symbol, target);
+      return target;
+    }
+
+  private:
+    std::uint32_t add_set(std::vector<std::uint32_t> set) {
+      std::sort(set.begin(), set.end());
+      set.erase(std::unique(set.begin(), set.end()), set.end());
+      auto [it, inserted] =
+          ids.emplace(set, static_cast<std::uint32_t>(sets.size()));
+      if (inserted) {
+        accepting.push_back(std::binary_search(set.begin(), set.end(),
+                                               pattern.accept));
+        sets.push_back(std::move(set));
+        transitions.emplace_back();
+      }
+      return it->second;
+    }
+
+    const KeyPattern &pattern;
+    std::map<std::vector<std::uint32_t>, std::uint32_t> ids;
+    std::vector<std::vector<std::uint32_t>> sets;
+    std::vector<bool> accepting;
+    std::vector<std::map<Symbol, std::uint32_t>> transitions;
+    std::uint32_t start_state;
+  };
+
+private:
+  static constexpr std::uint32_t none = UINT32_MAX;
+
+  // States either consume one symbol out of a set and continue at out, or
+  // continue at out and out2 (if set) without consuming anything.
+  struct State {
+    enum Kind { symbols, epsilon } kind;
+    // inclusive ranges of symbols
+    std::vector<std::pair<Symbol, Symbol>> ranges;
+    bool negated;
+    std::uint32_t out;
+    std::uint32_t out2;
+
+    bool matches(Symbol symbol) const {
+      for (auto &[first, last] : ranges) {
+        if (first <= symbol && symbol <= last) {
+          return !negated;
+        }
+      }
+      return negated;
+    }
+  };
+
+  // A part of the automaton from start to end, where end is an epsilon state
+  // without outgoing transitions yet.
+  struct Fragment {
+    std::uint32_t start;
+    std::uint32_t end;
+  };
+
+  KeyPattern() : states(), start(0), accept(0) {}
+
+  std::uint32_t add_state(State state) {
+    states.push_back(std::move(state));
+    return static_cast<std::uint32_t>(states.size() - 1);
+  }
+
+  std::uint32_t add_epsilon(std::uint32_t out = none,
+                            std::uint32_t out2 = none) {
+    return add_state(State{State::epsilon, {}, false, out, out2});
+  }
+
+  Fragment empty_fragment() {
+    std::uint32_t state = add_epsilon();
+    return {state, state};
+  }
+
+  Fragment symbols(std::vector<std::pair<Symbol, Symbol>> ranges,
+                   bool negated) {
+    std::uint32_t end = add_epsilon();
+    std::uint32_t state =
+        add_state(State{State::symbols, std::move(ranges), negated, end, none});
+    return {state, end};
+  }
+
+  Fragment concatenate(Fragment first, Fragment second) {
+    states[first.end].out = second.start;
+    return {first.start, second.end};
+  }
+
+  Fragment star(Fragment item) {
+    std::uint32_t end = add_epsilon();
+    std::uint32_t split = add_epsilon(item.start, end);
+    states[item.end].out = split;
+    return {split, end};
+  }
+
+  // Adds all states reachable from state without consuming a symbol.
+  void add_closure(std::uint32_t state,
+                   std::vector<std::uint32_t> &set) const {
+    std::vector<std::uint32_t> pending{state};
+    while (!pending.empty()) {
+      std::uint32_t current = pending.back();
+      pending.pop_back();
+      if (std::find(set.begin(), set.end(), current) != set.end()) {
+        continue;
+      }
+      set.push_back(current);
+      const State &s = states[current];
+      if (s.kind == State::epsilon) {
+        if (s.out != none) {
+          pending.push_back(s.out);
+        }
+        if (s.out2 != none) {
+          pending.push_back(s.out2);
+        }
+      }
+    }
+  }
+
+  // A literal symbol, possibly escaped, or a set of symbols.
+  Fragment parse_symbol(std::basic_string_view<Symbol> pattern,
+                        std::size_t &pos) {
+    if (pattern[pos] == Symbol('[')) {
+      pos++;
+      bool negated = pos != pattern.size() && pattern[pos] == Symbol('^');
+      pos += negated;
+      std::vector<std::pair<Symbol, Symbol>> ranges;
+      while (pos != pattern.size() && pattern[pos] != Symbol(']')) {
+        Symbol first = parse_literal(pattern, pos);
+        Symbol last = first;
+        if (pos + 1 < pattern.size() && pattern[pos] == Symbol('-') &&
+            pattern[pos + 1] != Symbol(']')) {
+          pos++;
+          last = parse_literal(pattern, pos);
+        }
+        ranges.emplace_back(first, last);
+      }
+      if (pos == pattern.size()) {
+        throw std::invalid_argument("unterminated [ in pattern");
+      }
+      pos++;
+      return symbols(std::move(ranges), negated);
+    }
+    Symbol symbol = parse_literal(pattern, pos);
+    return symbols({{symbol, symbol}}, false);
+  }
+
+  Symbol parse_literal(std::basic_string_view<Symbol> pattern,
+                       std::size_t &pos) {
+    if (pattern[pos] == Symbol('\\')) {
+      pos++;
+      if (pos == pattern.size()) {
+        throw std::invalid_argument("pattern ends with \\");
+      }
+    }
+    return pattern[pos++];
+  }
+
+  Fragment parse_alternatives(std::basic_string_view<Symbol> pattern,
+                              std::size_t &pos) {
+    Fragment alternative = parse_sequence(pattern, pos);
+    if (pos == pattern.size() || pattern[pos] != Symbol('|')) {
+      return alternative;
+    }
+    // a chain of splits, each leading to one alternative and the next split
+    std::uint32_t end = add_epsilon();
+    std::uint32_t first_split = add_epsilon(alternative.start);
+    std::uint32_t split = first_split;
+    states[alternative.end].out = end;
+    while (pos != pattern.size() && pattern[pos] == Symbol('|')) {
+      pos++;
+      alternative = parse_sequence(pattern, pos);
+      states[alternative.end].out = end;
+      if (states[split].out2 != none) {
+        std::uint32_t next = add_epsilon(states[split].out2);
+        states[split].out2 = next;
+        split = next;
+      }
+      states[split].out2 = alternative.start;
+    }
+    return {first_split, end};
+  }
+
+  Fragment parse_sequence(std::basic_string_view<Symbol> pattern,
+                          std::size_t &pos) {
+    Fragment sequence = empty_fragment();
+    while (pos != pattern.size() && pattern[pos] != Symbol('|') &&
+           pattern[pos] != Symbol(')')) {
+      std::uint32_t first = static_cast<std::uint32_t>(states.size());
+      Fragment item;
+      if (pattern[pos] == Symbol('(')) {
+        pos++;
+        item = parse_alternatives(pattern, pos);
+        if (pos == pattern.size()) {
+          throw std::invalid_argument("unbalanced ( in pattern");
+        }
+        pos++;
+      } else if (pattern[pos] == Symbol('.')) {
+        pos++;
+        item = symbols({}, true);
+      } else if (pattern[pos] == Symbol('*') || pattern[pos] == Symbol('+') ||
+                 pattern[pos] == Symbol('?')) {
+        throw std::invalid_argument("repetition of nothing in pattern");
+      } else {
+        item = parse_symbol(pattern, pos);
+      }
+      while (pos != pattern.size()) {
+        if (pattern[pos] == Symbol('*')) {
+          item = star(item);
+        } else if (pattern[pos] == Symbol('+')) {
+          // one item followed by the repetition of a copy of it
+          Fragment copy = clone(item, first);
+          item = concatenate(item, star(copy));
+        } else if (pattern[pos] == Symbol('?')) {
+          std::uint32_t end = add_epsilon();
+          std::uint32_t split = add_epsilon(item.start, end);
+          states[item.end].out = end;
+          item = {split, end};
+        } else {
+          break;
+        }
+        pos++;
+      }
+      sequence = concatenate(sequence, item);
+    }
+    return sequence;
+  }
+
+  // Copies the states from first on, which make up the given fragment and
+  // only refer to each other.
+  Fragment clone(Fragment item, std::uint32_t first) {
+    std::uint32_t offset = static_cast<std::uint32_t>(states.size()) - first;
+    std::uint32_t last = static_cast<std::uint32_t>(states.size());
+    for (std::uint32_t state = first; state != last; state++) {
+      State copy = states[state];
+      if (copy.out != none) {
+        copy.out += offset;
+      }
+      if (copy.out2 != none) {
+        copy.out2 += offset;
+      }
+      states.push_back(std::move(copy));
+    }
+    return {item.start + offset, item.end + offset};
+  }
+
+  std::vector<State> states;
+  std::uint32_t start;
+  std::uint32_t accept;
+};
+
+// What Trie::tokenize does at a position where no key starts:
+// skip: drop the symbol.
+// single: emit the symbol as a token without a value.
+// merge: emit each run of such symbols as one token without a value.
+// stop: stop tokenizing.
+enum class Unmatched { skip, single, merge, stop };
+
+// KeyType: Type of Key
+// ValueType: Type of values. Use DetachedValue<T> to store values of type T
+// outside of the nodes.
+// Converter: Provides functions to get symbols in the key at specific
+// positions and the key's size. If none is specified, operator[] and
+// std::size() are used. Must adhere to concept ConverterType<KeyType>.
+// Storage: The type of storage to use. Default: MapStorage. Must adhere to
+// concept StorageType<KeyType, Converter::KeyContent, ValueType>.
+// root_table_size: If non-zero, the trie keeps a direct-indexed table of all
+// nodes at depth 2, so that lookups skip the first two levels in one access.
+// The table has root_table_size * root_table_size entries; the index of every
+// symbol (see root_table_index()) must be less than root_table_size, e.g. 256
+// when KeyContent is char. Default: 0 (no table).
+template <
+    typename KeyType, typename ValueType,
+    ConverterType<KeyType> Converter = DummyConverter<KeyType>,
+    StorageType<KeyType, typename Converter::KeyContent, ValueType> Storage =
+        MapStorage<KeyType, typename Converter::KeyContent, ValueType>,
+    std::size_t root_table_size = 0>
+class Trie {
+private:
+  using KeyContent = typename Converter::KeyContent;
+  using TrieNode_instance = TrieNode<KeyType, KeyContent, ValueType, Storage>;
+  using ValueStore = typename TrieValueTraits<
+      KeyType, ValueType>::template store_type<TrieNode_instance>;
+
+public:
+  // The type of the values as seen by users of the trie, i.e. T if ValueType
+  // is DetachedValue<T> and ValueType otherwise.
+  using MappedType = typename TrieValueTraits<KeyType, ValueType>::mapped_type;
+
+  // A part of a text found by tokenize(): offset and length in symbols, and
+  // the value of the key, or nullptr for unmatched symbols.
+  struct Token {
+    std::size_t offset;
+    std::size_t length;
+    const MappedType *value;
+  };
+
+  // A key found by fuzzy_search(), its edit distance to the query, and its
+  // value.
+  struct FuzzyMatch {
+    KeyType key;
+    std::size_t distance;
+    const MappedType *value;
+  };
+
+  // A page of keys returned by scan(), with pointers to their values. If
+  // there are more keys, continuation is the key to pass as after_key to get
+  // the next page.
+  struct ScanPage {
+    std::vector<std::pair<KeyType, const MappedType *>> entries;
+    std::optional<KeyType> continuation;
+  };
+
+  class Iterator;
+  class NodeHandle;
+  class Cursor;
+  class Finger;
+  class OrderedIterator;
+  class OrderedRange;
+
+  Trie()
+      : root(std::make_shared<TrieNode_instance>(nullptr, KeyContent{})),
+        root_table(root_table_size * root_table_size, nullptr), values() {}
+
+  Trie(const Trie &trie)
+      : root(std::make_shared<TrieNode_instance>(*trie.root)),
+        root_table(root_table_size * root_table_size, nullptr),
+        values(trie.values) {
+    rebuild_root_table();
+  }
+
+  Trie(Trie &&other) { swap(*this, other); }
+
+  ~Trie() {}
+
+  friend void swap(Trie &t1, Trie &t2) {
+    std::swap(t1.root, t2.root);
+    std::swap(t1.root_table, t2.root_table);
+    std::swap(t1.values, t2.values);
+  }
+
+  Trie &operator=(const Trie &other) { return *this = Trie(other); }
+
+  Trie &operator=(Trie &&other) {
+    swap(*this, other);
+    return *this;
+  }
+
+  // Inserts a key-value pair into the trie.
+  // If the given key is already associated with a value,
+  // then this old value is overridden with the new value.
+  // This method returns an optional that contains the
+  // value previously associated with the given key, or an empty one
+  // if there is no such value.
+  std::optional<MappedType> insert(const KeyType &key, MappedType to_insert) {
+    TrieNode_instance *insert_at_node = mk_path_to_node(key);
+    values.set_key(insert_at_node, key);
+    std::optional to_insert_o(std::move(to_insert));
+    values.value(insert_at_node).swap(to_insert_o);
+    return to_insert_o;
+  }
+
+  // Constructs a value from args in place if the key is not associated with a
+  // value yet. Otherwise, nothing happens; in particular, args are not moved
+  // from. Returns a pointer to the value associated with the key and whether
+  // a new value was constructed.
+  template <typename... Args>
+  std::pair<MappedType *, bool> try_emplace(const KeyType &key,
+                                            Args &&...args) {
+    return try_emplace_at(mk_path_to_node(key), key,
+                          std::forward<Args>(args)...);
+  }
+
+  template <typename... Args>
+  std::pair<MappedType *, bool> try_emplace(KeyType &&key, Args &&...args) {
+    return try_emplace_at(mk_path_to_node(key), std::move(key),
+                          std::forward<Args>(args)...);
+  }
+
+  // Assigns to_assign to the value associated with the key, or constructs it
+  // in place if there is no such value. Returns a pointer to the value and
+  // whether a new value was constructed.
+  template <typename M>
+  std::pair<MappedType *, bool> insert_or_assign(const KeyType &key,
+                                                 M &&to_assign) {
+    return insert_or_assign_at(mk_path_to_node(key), key,
+                               std::forward<M>(to_assign));
+  }
+
+  template <typename M>
+  std::pair<MappedType *, bool> insert_or_assign(KeyType &&key,
+                                                 M &&to_assign) {
+    return insert_or_assign_at(mk_path_to_node(key), std::move(key),
+                               std::forward<M>(to_assign));
+  }
+
+  // Returns a pointer to the value associated with the key, or nullptr if
+  // there is no such value. Unlike at(), this does not copy the value.
+  MappedType *find(const KeyType &key) { return find_value(key); }
+
+  const MappedType *find(const KeyType &key) const { return find_value(key); }
+
+  MappedType *find(const KeyType &key, Finger &finger) {
+    TrieNode_instance *target_node = find_node(key, finger);
+    return target_node && values.has_value(target_node)
+               ? &*values.value(target_node)
+               : nullptr;
+  }
+
+  std::optional<MappedType> at(KeyType &key) const {
+    TrieNode_instance *current_node = find_node(key);
+    return current_node && values.has_value(current_node)
+               ? values.value(current_node)
+               : std::optional<MappedType>();
+  }
+
+  std::optional<MappedType> at(KeyType &&key) const { return at(key); }
+
+  // Looks up a key starting from the point where it diverges from the key
+  // previously looked up with the same finger. See Finger.
+  std::optional<MappedType> at(const KeyType &key, Finger &finger) const {
+    TrieNode_instance *current_node = find_node(key, finger);
+    return current_node && values.has_value(current_node)
+               ? values.value(current_node)
+               : std::optional<MappedType>();
+  }
+
+  std::optional<MappedType> &operator[](KeyType key) {
+    TrieNode_instance *insert_at_node = mk_path_to_node(key);
+    values.set_key(insert_at_node, std::move(key));
+    return values.value(insert_at_node);
+  }
+
+  bool has_key(const KeyType &key) const {
+    TrieNode_instance *target_node = find_node(key);
+    return target_node && values.has_value(target_node);
+  }
+
+  // Returns a handle to the value slot of the key, through which the value can
+  // be read and modified repeatedly without walking the path from the root.
+  // Like operator[], this creates the key with an empty value if it does not
+  // exist yet. See NodeHandle for how long the handle stays valid.
+  NodeHandle handle(KeyType key) {
+    TrieNode_instance *target_node = mk_path_to_node(key);
+    values.set_key(target_node, std::move(key));
+    return NodeHandle(target_node, &values);
+  }
+
+  // Heterogeneous lookups: at, has_key, operator[] and subtrie_iterator also
+  // accept keys of other types that the Converter can read, e.g.
+  // std::string_view or const char * for std::string keys. No KeyType is
+  // constructed for them, except by operator[] when it inserts a new key.
+  template <HeterogeneousKey<KeyType, Converter> K>
+  std::optional<MappedType> at(const K &key) const {
+    TrieNode_instance *current_node = find_node(key);
+    return current_node && values.has_value(current_node)
+               ? values.value(current_node)
+               : std::optional<MappedType>();
+  }
+
+  std::optional<MappedType> at(const KeyContent *key) const
+      requires CStringKeyContent<KeyContent, Converter> {
+    return at(std::basic_string_view<KeyContent>(key));
+  }
+
+  template <HeterogeneousKey<KeyType, Converter> K>
+  requires std::constructible_from<KeyType, const K &> ||
+      std::constructible_from<KeyType, decltype(std::begin(std::declval<K>())),
+                              decltype(std::end(std::declval<K>()))>
+          std::optional<MappedType> &operator[](const K &key) {
+    TrieNode_instance *target_node = find_node(key);
+    if (target_node && values.has_value(target_node)) {
+      return values.value(target_node);
+    }
+    if constexpr (std::constructible_from<KeyType, const K &>) {
+      return (*this)[KeyType(key)];
+    } else {
+      return (*this)[KeyType(std::begin(key), std::end(key))];
+    }
+  }
+
+  std::optional<MappedType> &operator[](const KeyContent *key) requires
+      CStringKeyContent<KeyContent, Converter> {
+    return (*this)[std::basic_string_view<KeyContent>(key)];
+  }
+
+  template <HeterogeneousKey<KeyType, Converter> K>
+  bool has_key(const K &key) const {
+    TrieNode_instance *target_node = find_node(key);
+    return target_node && values.has_value(target_node);
+  }
+
+  bool has_key(const KeyContent *key) const
+      requires CStringKeyContent<KeyContent, Converter> {
+    return has_key(std::basic_string_view<KeyContent>(key));
+  }
+
+  template <HeterogeneousKey<KeyType, Converter> K>
+  MappedType *find(const K &key) {
+    return find_value(key);
+  }
+
+  template <HeterogeneousKey<KeyType, Converter> K>
+  const MappedType *find(const K &key) const {
+    return find_value(key);
+  }
+
+  MappedType *find(const KeyContent *key) requires
+      CStringKeyContent<KeyContent, Converter> {
+    return find_value(std::basic_string_view<KeyContent>(key));
+  }
+
+  const MappedType *find(const KeyContent *key) const
+      requires CStringKeyContent<KeyContent, Converter> {
+    return find_value(std::basic_string_view<KeyContent>(key));
+  }
+
+  // Removes a key and its associated value from the trie.
+  // Nodes that are no longer needed afterwards are deleted, which invalidates
+  // all iterators pointing to them.
+  // This method returns an optional that contains the value
+  // that was associated with the given key, or an empty one
+  // if there is no such value.
+  std::optional<MappedType> erase(const KeyType &key) {
+    TrieNode_instance *target_node = find_node(key);
+    std::optional<MappedType> erased;
+    if (!target_node) {
+      return erased;
+    }
+    if (values.has_value(target_node)) {
+      values.value(target_node).swap(erased);
+    }
+    values.release(target_node);
+    prune(target_node);
+    return erased;
+  }
+
+  // Calls f(value) for every value in the trie, in no particular order.
+  // With DetachedValue, this is a linear sweep over the values that does not
+  // touch the nodes at all.
+  template <typename F> void for_each_value(F f) {
+    values.for_each_value(root.get(), f);
+  }
+
+  // Relocates all nodes into one contiguous block of memory. The first
+  // breadth_first_levels levels, which are visited by almost every lookup, are
+  // placed at the start of the block in breadth-first order. The subtries
+  // below them follow in depth-first order, so that children are placed right
+  // after their parents. This speeds up lookups and iteration on tries that
+  // were built by incremental insertions. All iterators and NodeHandles are
+  // invalidated.
+  // While compacting, the old and the new nodes are held in memory at the same
+  // time. Memory of nodes that are erased afterwards is only released once all
+  // nodes of the block are gone, so compact() is best used on tries that are
+  // mostly read.
+  void compact(std::size_t breadth_first_levels = 3) {
+    NodeArenaAllocator<TrieNode_instance> allocator(
+        std::make_shared<NodeArena>(count_nodes(root.get())));
+    std::shared_ptr<TrieNode_instance> new_root =
+        relocate_node(root.get(), nullptr, allocator);
+
+    // pairs of (old node, relocated node)
+    std::vector<std::pair<TrieNode_instance *, TrieNode_instance *>> level{
+        {root.get(), new_root.get()}};
+    for (std::size_t depth = 0; depth < breadth_first_levels; ++depth) {
+      std::vector<std::pair<TrieNode_instance *, TrieNode_instance *>>
+          next_level;
+      for (auto [node, relocated] : level) {
+        for (auto it = node->children.begin(); it != node->children.end();
+             ++it) {
+          if (*it) {
+            auto child = relocate_node((*it).get(), relocated, allocator);
+            next_level.emplace_back((*it).get(), child.get());
+            relocated->children[child->prefixed_by] = std::move(child);
+          }
+        }
+      }
+      level.swap(next_level);
+    }
+    for (auto [node, relocated] : level) {
+      relocate_children(node, relocated, allocator);
+    }
+
+    root = new_root;
+    rebuild_root_table();
+  }
+
+  // Set operations: Both tries are walked in lock-step, symbol by symbol, so
+  // only the paths that both tries have in common are visited. Like erase(),
+  // they invalidate Fingers of the tries they change.
+
+  // Moves all keys of other into this trie and leaves other empty. For keys
+  // in both tries, the value becomes resolve(value, other_value), where both
+  // values are passed as rvalues. Subtries of other below a path that this
+  // trie does not have are spliced in as a whole, without copying their
+  // nodes or keys (with DetachedValue, their values are moved to new slots).
+  // Iterators into other stay valid and now iterate this trie.
+  template <typename Resolve> void merge(Trie &&other, Resolve resolve) {
+    if (&other == this) {
+      return;
+    }
+    merge_below(root.get(), other.root.get(), other.values, resolve);
+    rebuild_root_table();
+    other = Trie();
+  }
+
+  // Returns the keys of a that are also keys of b, with their values in a.
+  // The result is made from a's nodes: Subtries of a below symbols that b
+  // does not have are dropped as a whole. Pass a as an rvalue if it is not
+  // needed anymore.
+  friend Trie intersect(Trie a, const Trie &b) {
+    a.intersect_below(a.root.get(), b.root.get(), b.values);
+    a.rebuild_root_table();
+    return a;
+  }
+
+  // Returns the keys of a that are not keys of b, with their values in a.
+  // Like intersect(), the result is made from a's nodes, and subtries of a
+  // below symbols that b does not have are kept as a whole.
+  friend Trie difference(Trie a, const Trie &b) {
+    a.difference_below(a.root.get(), b.root.get(), b.values);
+    a.rebuild_root_table();
+    return a;
+  }
+
+  Iterator begin() { return Iterator(root, &values); }
+
+  Iterator end() { return Iterator(); }
+
+  // note that this also works if there is no node with the given prefix.
+  Iterator subtrie_iterator(const KeyType &prefix) const {
+    return Iterator(owning_pointer(find_node(prefix)), &mutable_values());
+  }
+
+  Iterator subtrie_iterator(const KeyType &&prefix) const {
+    return Iterator(owning_pointer(find_node(prefix)), &mutable_values());
+  }
+
+  Iterator subtrie_iterator(const KeyType &prefix, std::size_t len) const {
+    return Iterator(owning_pointer(find_node(prefix, len)), &mutable_values());
+  }
+
+  Iterator subtrie_iterator(const KeyType &&prefix, std::size_t len) const {
+    return Iterator(owning_pointer(find_node(prefix, len)), &mutable_values());
+  }
+
+  template <HeterogeneousKey<KeyType, Converter> K>
+  Iterator subtrie_iterator(const K &prefix) const {
+    return Iterator(owning_pointer(find_node(prefix)), &mutable_values());
+  }
+
+  template <HeterogeneousKey<KeyType, Converter> K>
+  Iterator subtrie_iterator(const K &prefix, std::size_t len) const {
+    return Iterator(owning_pointer(find_node(prefix, len)), &mutable_values());
+  }
+
+  Iterator subtrie_iterator(const KeyContent *prefix) const
+      requires CStringKeyContent<KeyContent, Converter> {
+    return subtrie_iterator(std::basic_string_view<KeyContent>(prefix));
+  }
+
+  // Returns a cursor pointing to the root, i.e. to the empty prefix.
+  Cursor cursor() { return Cursor(this); }
+
+  // Returns the value of the longest key that is a prefix of the given key
+  // (the key itself included), together with that key's length in symbols.
+  // Returns an empty optional if no key is a prefix of the given key.
+  std::optional<std::pair<std::size_t, MappedType>>
+  longest_prefix_match(const KeyType &key) const {
+    return longest_prefix_match_of(key);
+  }
+
+  template <HeterogeneousKey<KeyType, Converter> K>
+  std::optional<std::pair<std::size_t, MappedType>>
+  longest_prefix_match(const K &key) const {
+    return longest_prefix_match_of(key);
+  }
+
+  // Returns the lengths and values of all keys that are prefixes of the given
+  // key (the key itself included), shortest first.
+  std::vector<std::pair<std::size_t, MappedType>>
+  all_prefix_matches(const KeyType &key) const {
+    return all_prefix_matches_of(key);
+  }
+
+  template <HeterogeneousKey<KeyType, Converter> K>
+  std::vector<std::pair<std::size_t, MappedType>>
+  all_prefix_matches(const K &key) const {
+    return all_prefix_matches_of(key);
+  }
+
+  // Splits text into keys by greedy maximal munch: At each position, the
+  // longest key that starts there becomes the next token, and tokenizing
+  // continues behind it. Positions where no key starts are handled according
+  // to the fallback policy. Tokens are written to out, an output iterator of
+  // Token. Returns the number of symbols consumed, which is the size of the
+  // text unless the policy is Unmatched::stop. The empty key is never a token.
+  // Each token costs one descent, and nothing is allocated.
+  template <typename OutputIt>
+  std::size_t tokenize(const KeyType &text, OutputIt out,
+                       Unmatched fallback = Unmatched::single) const {
+    return tokenize_of(text, out, fallback);
+  }
+
+  template <HeterogeneousKey<KeyType, Converter> K, typename OutputIt>
+  std::size_t tokenize(const K &text, OutputIt out,
+                       Unmatched fallback = Unmatched::single) const {
+    return tokenize_of(text, out, fallback);
+  }
+
+  // Returns all keys whose Levenshtein distance to the query (insertions,
+  // deletions and substitutions of single symbols) is at most max_edits, in
+  // the order of the storage.
+  // The search walks the trie and keeps one row of the edit distance table
+  // per depth: the row of a node is computed from its parent's row and its
+  // symbol. Subtries are skipped once every entry of the row exceeds
+  // max_edits, so only nodes within max_edits of some prefix of the query are
+  // visited.
+  std::vector<FuzzyMatch> fuzzy_search(const KeyType &query,
+                                       std::size_t max_edits) const {
+    return fuzzy_search_of(query, max_edits);
+  }
+
+  template <HeterogeneousKey<KeyType, Converter> K>
+  std::vector<FuzzyMatch> fuzzy_search(const K &query,
+                                       std::size_t max_edits) const {
+    return fuzzy_search_of(query, max_edits);
+  }
+
+  // Returns the keys that match the pattern, and pointers to their values, in
+  // the order of the storage. The search runs the pattern's automaton along
+  // the trie and skips every subtrie where no state of the automaton is left.
+  std::vector<std::pair<KeyType, const MappedType *>>
+  pattern_search(const KeyPattern<KeyContent> &pattern) const {
+    std::vector<std::pair<KeyType, const MappedType *>> matches;
+    typename KeyPattern<KeyContent>::Matcher matcher(pattern);
+    pattern_search_below(root.get(), matcher.start(), matcher, matches);
+    return matches;
+  }
+
+  // Returns the k keys with the largest values among the keys that start
+  // with prefix, largest first, and pointers to their values. Keys with equal
+  // values come in any order.
+  // Requires a ValueType Aggregated<T, Monoid> where Monoid::lift() gives the
+  // score of a value and combine() returns the larger of two scores, like
+  // MaxOf<T>. The search is best first: a priority queue holds subtries by
+  // their maximum and values by their score, so only the paths to the k keys
+  // and the children of nodes on them are visited.
+  std::vector<std::pair<KeyType, const MappedType *>>
+  top_k(const KeyType &prefix, std::size_t k) const
+      requires AggregatingStoreType<ValueStore, TrieNode_instance> {
+    return top_k_of(prefix, k);
+  }
+
+  template <HeterogeneousKey<KeyType, Converter> K>
+  std::vector<std::pair<KeyType, const MappedType *>>
+  top_k(const K &prefix, std::size_t k) const
+      requires AggregatingStoreType<ValueStore, TrieNode_instance> {
+    return top_k_of(prefix, k);
+  }
+
+  // Returns the aggregate of the values of all keys that start with prefix
+  // under the Monoid of the ValueType Aggregated<T, Monoid>, or the identity
+  // if there are none. It is read from the prefix's node, after recomputing
+  // the aggregates that changed since the last call.
+  auto aggregate(const KeyType &prefix) const
+      requires AggregatingStoreType<ValueStore, TrieNode_instance> {
+    return aggregate_of(prefix);
+  }
+
+  template <HeterogeneousKey<KeyType, Converter> K>
+  auto aggregate(const K &prefix) const
+      requires AggregatingStoreType<ValueStore, TrieNode_instance> {
+    return aggregate_of(prefix);
+  }
+
+  // Counting: With a ValueType Aggregated<T, CountOf<T>> (or any monoid that
+  // provides count()), every node knows the number of keys in its subtrie.
+  // Returns the number of keys that start with prefix.
+  std::size_t count_prefix(const KeyType &prefix) const
+      requires CountingStoreType<ValueStore, TrieNode_instance> {
+    return count_prefix_of(prefix);
+  }
+
+  template <HeterogeneousKey<KeyType, Converter> K>
+  std::size_t count_prefix(const K &prefix) const
+      requires CountingStoreType<ValueStore, TrieNode_instance> {
+    return count_prefix_of(prefix);
+  }
+
+  // Returns the number of keys that are less than key in key order (see
+  // ordered_begin()), whether key is in the trie or not. The keys of
+  // subtries before the key's path are counted without visiting them.
+  std::size_t rank(const KeyType &key) const
+      requires CountingStoreType<ValueStore, TrieNode_instance> &&
+      OrderedStorageType<Storage, KeyContent> {
+    using Monoid = typename ValueStore::monoid_type;
+    std::size_t rank = 0;
+    TrieNode_instance *current_node = root.get();
+    std::size_t key_size = Converter::size(key);
+    for (std::size_t pos_in_key = 0; pos_in_key != key_size; pos_in_key++) {
+      if (values.has_value(current_node)) {
+        rank++;
+      }
+      KeyContent next_node_index = Converter::get_at_index(key, pos_in_key);
+      auto bound = current_node->children.lower_bound(next_node_index);
+      for (auto it = current_node->children.begin(); it != bound; ++it) {
+        if (*it) {
+          rank += Monoid::count(values.aggregate((*it).get()));
+        }
+      }
+      if (!(bound != current_node->children.end()) || !*bound ||
+          (*bound)->prefixed_by != next_node_index) {
+        return rank;
+      }
+      current_node = (*bound).get();
+    }
+    return rank;
+  }
+
+  // Returns an iterator to the key of rank i, i.e. the (i + 1)-th key in key
+  // order, or ordered_end() if there are at most i keys. Iteration can
+  // continue from there.
+  OrderedIterator select(std::size_t i) const
+      requires CountingStoreType<ValueStore, TrieNode_instance> &&
+      OrderedStorageType<Storage, KeyContent> {
+    using Monoid = typename ValueStore::monoid_type;
+    if (i >= Monoid::count(values.aggregate(root.get()))) {
+      return ordered_end();
+    }
+    OrderedIterator it(&mutable_values());
+    TrieNode_instance *current_node = root.get();
+    while (true) {
+      if (values.has_value(current_node)) {
+        if (i == 0) {
+          it.stack.push_back({current_node, current_node->children.begin()});
+          return it;
+        }
+        i--;
+      }
+      // find the child whose subtrie contains the key
+      for (auto child = current_node->children.begin();
+           child != current_node->children.end(); ++child) {
+        if (!*child) {
+          continue;
+        }
+        std::size_t count = Monoid::count(values.aggregate((*child).get()));
+        if (i < count) {
+          auto next_child = child;
+          ++next_child;
+          it.stack.push_back({current_node, next_child});
+          current_node = (*child).get();
+          break;
+        }
+        i -= count;
+      }
+    }
+  }
+
+  // Sampling: With a counting ValueType (see count_prefix()), keys can be
+  // drawn uniformly at random without visiting the other keys.
+  // Returns a key that starts with prefix, drawn uniformly at random with the
+  // random bit generator rng, and a pointer to its value, or nothing if no key
+  // starts with prefix. From the prefix's node, the descent enters each child
+  // with a probability proportional to the number of keys below it.
+  template <typename Generator>
+  std::optional<std::pair<KeyType, const MappedType *>>
+  sample(const KeyType &prefix, Generator &rng) const
+      requires CountingStoreType<ValueStore, TrieNode_instance> {
+    return sample_of(prefix, rng);
+  }
+
+  template <HeterogeneousKey<KeyType, Converter> K, typename Generator>
+  std::optional<std::pair<KeyType, const MappedType *>>
+  sample(const K &prefix, Generator &rng) const
+      requires CountingStoreType<ValueStore, TrieNode_instance> {
+    return sample_of(prefix, rng);
+  }
+
+  // Returns min(k, count_prefix(prefix)) distinct keys that start with
+  // prefix, drawn uniformly at random without replacement, and pointers to
+  // their values. The keys come in the order in which the storage enumerates
+  // children, i.e. in key order for ordered storages. Their ranks below the
+  // prefix are drawn first; then one descent splits them among the children,
+  // so that shared parts of the paths are visited once.
+  template <typename Generator>
+  std::vector<std::pair<KeyType, const MappedType *>>
+  sample(const KeyType &prefix, std::size_t k, Generator &rng) const
+      requires CountingStoreType<ValueStore, TrieNode_instance> {
+    return sample_of(prefix, k, rng);
+  }
+
+  template <HeterogeneousKey<KeyType, Converter> K, typename Generator>
+  std::vector<std::pair<KeyType, const MappedType *>>
+  sample(const K &prefix, std::size_t k, Generator &rng) const
+      requires CountingStoreType<ValueStore, TrieNode_instance> {
+    return sample_of(prefix, k, rng);
+  }
+
+  // Key order: keys are compared symbol by symbol in the order in which the
+  // storage enumerates children, and a key comes before all keys it is a
+  // prefix of. For std::string keys with ASCII characters, this is the order
+  // of std::map<std::string, ...>. See OrderedIterator.
+  OrderedIterator ordered_begin() const
+      requires OrderedStorageType<Storage, KeyContent> {
+    OrderedIterator it(&mutable_values());
+    it.stack.push_back({root.get(), root->children.begin()});
+    if (!values.has_value(root.get())) {
+      it.advance();
+    }
+    return it;
+  }
+
+  OrderedIterator ordered_end() const { return OrderedIterator(); }
+
+  // Returns at most limit keys that start with prefix, in key order, for
+  // listing them page by page. The page starts behind after_key, which is
+  // usually the continuation of the previous page; without one, or if it
+  // does not start with prefix, the page starts at the first key with the
+  // prefix. Finding the start of a page costs one descent, no matter how many
+  // pages came before it.
+  ScanPage scan(const KeyType &prefix,
+                const std::optional<KeyType> &after_key,
+                std::size_t limit) const
+      requires OrderedStorageType<Storage, KeyContent> {
+    ScanPage page;
+    TrieNode_instance *subroot = find_node(prefix);
+    if (!subroot || limit == 0) {
+      return page;
+    }
+    std::size_t depth = Converter::size(prefix);
+    bool resume = after_key && Converter::size(*after_key) >= depth;
+    for (std::size_t pos_in_key = 0; resume && pos_in_key != depth;
+         pos_in_key++) {
+      resume = Converter::get_at_index(*after_key, pos_in_key) ==
+               Converter::get_at_index(prefix, pos_in_key);
+    }
+    OrderedIterator it = resume ? seek(*after_key, true) : seek(prefix, false);
+    // the keys with the prefix are those below subroot
+    auto in_prefix = [&] {
+      return it.stack.size() > depth && it.stack[depth].node == subroot;
+    };
+    for (; in_prefix() && page.entries.size() != limit; it.advance()) {
+      TrieNode_instance *node = it.current_node();
+      page.entries.emplace_back(values.key(node), &*values.value(node));
+    }
+    if (in_prefix()) {
+      page.continuation = page.entries.back().first;
+    }
+    return page;
+  }
+
+  // Returns an iterator to the first key in key order that is not less than
+  // the given key. Positioning takes O(key length).
+  OrderedIterator lower_bound(const KeyType &key) const
+      requires OrderedStorageType<Storage, KeyContent> {
+    return seek(key, false);
+  }
+
+  // Returns an iterator to the first key in key order that is greater than the
+  // given key.
+  OrderedIterator upper_bound(const KeyType &key) const
+      requires OrderedStorageType<Storage, KeyContent> {
+    return seek(key, true);
+  }
+
+  std::pair<OrderedIterator, OrderedIterator>
+  equal_range(const KeyType &key) const
+      requires OrderedStorageType<Storage, KeyContent> {
+    return {lower_bound(key), upper_bound(key)};
+  }
+
+  // All keys k with first <= k < last in key order.
+  OrderedRange range(const KeyType &first, const KeyType &last) const
+      requires OrderedStorageType<Storage, KeyContent> {
+    return OrderedRange(lower_bound(first), lower_bound(last));
+  }
+
+  class Iterator {
+    friend class Trie<KeyType, ValueType, Converter, Storage, root_table_size>;
 
   public:
-    std::pair<KeyType, ValueType> operator*() {
+    std::pair<KeyType, MappedType> operator*() {
       assert(current_node);
 
       // it is not necessary to check if the optionals key and elem actually
       // contain values, because in operator++ we guarantee that only entries
       // containing a value (and thereby also a key) are visited.
-      return std::pair<KeyType, ValueType>(current_node->key.value(),
-                                           current_node->elem.value());
+      return std::pair<KeyType, MappedType>(
+          values->key(current_node), values->value(current_node).value());
+    }
+
+    KeyType key() {
+      assert(current_node);
+      return values->key(current_node);
+    }
+
+    // A value can be modified via iterator.
+    MappedType &value() {
+      assert(current_node);
+      return values->value(current_node).value();
+    }
+
+    Iterator &operator++() {
+      assert(current_node);
+      advance();
+      return *this;
+    }
+
+    bool operator==(const Iterator &other) const {
+      return current_node == other.current_node;
+    }
+
+    bool operator!=(const Iterator &other) const { return !(*this == other); }
+
+  private:
+    Iterator(std::shared_ptr<TrieNode_instance> root_node, ValueStore *values)
+        : values(values),
+          current_node(leftmost_bottommost_node(root_node.get())),
+          root(root_node) {}
+
+    Iterator() : values(nullptr), current_node(nullptr), root(nullptr) {}
+
+    void advance() { next_postorder(); }
+
+    void next_postorder() {
+      if (current_node == root.get()) {
+        current_node = nullptr;
+        return;
+      }
+
+      // go to parent; find the leftmost node in all subtries to the right that
+      // has a value.
+      auto child_it =
+          current_node->parent->children.find(current_node->prefixed_by);
+      ++child_it;
+      for (; child_it != current_node->parent->children.end(); ++child_it) {
+        TrieNode_instance *next = leftmost_bottommost_node((*child_it).get());
+        if (next && values->has_value(next)) {
+          current_node = next;
+          return;
+        }
+      }
+
+      // if there is no node in the subtries to the right with a value, go to
+      // parent.
+      if (values->has_value(current_node->parent)) {
+        current_node = current_node->parent;
+        return;
+      }
+
+      // if parent has no value either, go one step up and continue search.
+      current_node = current_node->parent;
+      next_postorder();
+    }
+
+    // Returns a pointer to the leftmost-bottommost node with an attached
+    // element in the structure where subroot is the root node. (i.e. the one
+    // that is to be traversed first in this structure). If there are no
+    // children, return nullptr
+    TrieNode_instance *leftmost_bottommost_node(TrieNode_instance *subroot) {
+      if (!subroot) {
+        return nullptr;
+      }
+
+      TrieNode_instance *leftmost = nullptr;
+      for (auto it = subroot->children.begin(); it != subroot->children.end();
+           ++it) {
+        leftmost = leftmost_bottommost_node((*it).get());
+        if (leftmost && values->has_value(leftmost)) {
+          return leftmost;
+        }
+      }
+      return values->has_value(subroot) ? subroot : nullptr;
+    }
+
+    ValueStore *values;
+    TrieNode_instance *current_node;
+    const std::shared_ptr<TrieNode_instance> root;
+  };
+
+  // A stable reference to the value slot of a key, obtained by handle().
+  // A handle stays valid until its key is erased. If the key has no value, the
+  // node may also be deleted when a longer key is erased, which invalidates
+  // the handle as well. compact() invalidates all handles, as does assigning
+  // to, moving or destroying the trie.
+  class NodeHandle {
+    friend class Trie<KeyType, ValueType, Converter, Storage, root_table_size>;
+
+  public:
+    NodeHandle() : values(nullptr), node(nullptr) {}
+
+    // Like operator[], this gives access to the possibly empty value.
+    std::optional<MappedType> &operator*() const {
+      assert(node);
+      return values->value(node);
+    }
+
+    std::optional<MappedType> *operator->() const { return &**this; }
+
+    const KeyType &key() const {
+      assert(node);
+      return values->key(node);
+    }
+
+    explicit operator bool() const { return node != nullptr; }
+
+  private:
+    NodeHandle(TrieNode_instance *node, ValueStore *values)
+        : values(values), node(node) {}
+
+    ValueStore *values;
+    TrieNode_instance *node;
+  };
+
+  // Enumerates keys in key order (see ordered_begin()), i.e. parents before
+  // their children, unlike Iterator. Each step costs O(1) amortized.
+  // Invalidated like Iterator.
+  class OrderedIterator {
+    friend class Trie<KeyType, ValueType, Converter, Storage, root_table_size>;
+
+  public:
+    std::pair<KeyType, MappedType> operator*() {
+      assert(current_node());
+      return std::pair<KeyType, MappedType>(
+          values->key(current_node()), values->value(current_node()).value());
+    }
+
+    KeyType key() {
+      assert(current_node());
+      return values->key(current_node());
+    }
+
+    MappedType &value() {
+      assert(current_node());
+      return values->value(current_node()).value();
+    }
+
+    OrderedIterator &operator++() {
+      assert(current_node());
+      advance();
+      return *this;
+    }
+
+    bool operator==(const OrderedIterator &other) const {
+      return current_node() == other.current_node();
+    }
+
+    bool operator!=(const OrderedIterator &other) const {
+      return !(*this == other);
+    }
+
+  private:
+    using ChildIterator = decltype(std::declval<Storage &>().begin());
+
+    // The path from the root to the current node. next_child is the next
+    // child of node to be visited.
+    struct Frame {
+      TrieNode_instance *node;
+      ChildIterator next_child;
+    };
+
+    OrderedIterator() : values(nullptr), stack() {}
+
+    OrderedIterator(ValueStore *values) : values(values), stack() {}
+
+    TrieNode_instance *current_node() const {
+      return stack.empty() ? nullptr : stack.back().node;
+    }
+
+    // Moves to the next node in pre-order that has a value.
+    void advance() {
+      while (!stack.empty()) {
+        Frame &top = stack.back();
+        while (top.next_child != top.node->children.end() &&
+               !*top.next_child) {
+          ++top.next_child;
+        }
+        if (top.next_child != top.node->children.end()) {
+          TrieNode_instance *child = (*top.next_child).get();
+          ++top.next_child;
+          stack.push_back(Frame{child, child->children.begin()});
+          if (values->has_value(child)) {
+            return;
+          }
+        } else {
+          stack.pop_back();
+        }
+      }
+    }
+
+    ValueStore *values;
+    std::vector<Frame> stack;
+  };
+
+  // The result of range(), for use in range-based for loops.
+  class OrderedRange {
+    friend class Trie<KeyType, ValueType, Converter, Storage, root_table_size>;
+
+  public:
+    OrderedIterator begin() const { return first; }
+
+    OrderedIterator end() const { return last; }
+
+  private:
+    OrderedRange(OrderedIterator first, OrderedIterator last)
+        : first(std::move(first)), last(std::move(last)) {}
+
+    OrderedIterator first;
+    OrderedIterator last;
+  };
+
+  // Remembers the path of the last lookup made with it, so that the next lookup
+  // only has to descend from the point where the two keys diverge. This pays
+  // off when keys are looked up in sorted or clustered order, where
+  // consecutive keys share long prefixes.
+  // A finger may be used with different tries; it starts over from the root
+  // when the trie changes. Insertions keep it valid, but erase() and compact()
+  // invalidate it, because they may delete nodes on its path.
+  class Finger {
+    friend class Trie<KeyType, ValueType, Converter, Storage, root_table_size>;
+
+  private:
+    // path[i] is the node of the first i symbols of the last key. Only the
+    // part of the last key that exists in the trie is remembered. The symbols
+    // of the last key are the nodes' prefixed_by.
+    std::vector<TrieNode_instance *> path;
+  };
+
+  // A prefix that can be extended or shortened one symbol at a time, e.g.
+  // while it is being typed. Each step costs a single child lookup instead of
+  // a descent from the root.
+  // The prefix may leave the trie, i.e. not be a prefix of any key. The
+  // cursor then becomes invalid until it has ascended back into the trie.
+  // Cursors are invalidated like iterators: by erasing the keys below them
+  // and by compact().
+  class Cursor {
+    friend class Trie<KeyType, ValueType, Converter, Storage, root_table_size>;
+
+  public:
+    // Appends a symbol to the prefix. Returns whether the cursor is valid
+    // afterwards.
+    bool descend(KeyContent symbol) {
+      if (missing == 0 && node->has_child(symbol)) {
+        node = node->children[symbol].get();
+      } else {
+        missing++;
+      }
+      return missing == 0;
+    }
+
+    // Removes the last symbol from the prefix. Returns false if the prefix
+    // was already empty.
+    bool ascend() {
+      if (missing > 0) {
+        missing--;
+      } else if (node != trie->root.get()) {
+        node = node->parent;
+      } else {
+        return false;
+      }
+      return true;
+    }
+
+    // Whether the prefix is a prefix of some key in the trie.
+    bool valid() const { return missing == 0; }
+
+    // Whether the prefix itself is a key in the trie.
+    bool has_value() const {
+      return missing == 0 && trie->values.has_value(node);
+    }
+
+    const KeyType &key() const {
+      assert(has_value());
+      return trie->values.key(node);
+    }
+
+    MappedType &value() {
+      assert(has_value());
+      return trie->values.value(node).value();
+    }
+
+    // Calls f with each symbol that extends the prefix into the trie, in the
+    // order of the storage.
+    template <typename F> void for_each_child(F f) const {
+      if (missing > 0) {
+        return;
+      }
+      for (auto it = node->children.begin(); it != node->children.end();
+           ++it) {
+        if (*it) {
+          f((*it)->prefixed_by);
+        }
+      }
+    }
+
+    // Enumerates all keys starting with the prefix.
+    Iterator subtrie() const {
+      return missing > 0 ? Iterator()
+                         : Iterator(trie->owning_pointer(node), &trie->values);
+    }
+
+  private:
+    Cursor(Trie *trie) : trie(trie), node(trie->root.get()), missing(0) {}
+
+    Trie *trie;
+    // The node of the longest part of the prefix that exists in the trie.
+    TrieNode_instance *node;
+    // The number of symbols of the prefix below node.
+    std::size_t missing;
+  };
+
+private:
+  std::shared_ptr<TrieNode_instance> root;
+
+  // Nodes at depth 2 indexed by their first two symbols (see
+  // root_table_size). Empty if root_table_size is 0.
+  std::vector<TrieNode_instance *> root_table;
+
+  [[no_unique_address]] ValueStore values;
+
+  // Like the nodes, values can be modified through iterators of const tries.
+  ValueStore &mutable_values() const {
+    return const_cast<ValueStore &>(values);
+  }
+
+  // internal constructor for making a subtrie
+  Trie(std::shared_ptr<TrieNode_instance> root)
+      : root(root), root_table(root_table_size * root_table_size, nullptr),
+        values() {
+    rebuild_root_table();
+  }
+
+  // Position of a symbol in a row of the root table.
+  static std::size_t root_table_index(KeyContent symbol) noexcept {
+    if constexpr (std::is_integral_v<KeyContent> &&
+                  !std::is_same_v<KeyContent, bool>) {
+      return static_cast<std::make_unsigned_t<KeyContent>>(symbol);
+    } else {
+      return static_cast<std::size_t>(symbol);
+    }
+  }
+
+  static std::size_t root_table_slot(KeyContent first, KeyContent second) {
+    std::size_t slot =
+        root_table_index(first) * root_table_size + root_table_index(second);
+    assert(slot < root_table_size * root_table_size);
+    return slot;
+  }
+
+  void rebuild_root_table() {
+    if constexpr (root_table_size > 0) {
+      std::fill(root_table.begin(), root_table.end(), nullptr);
+      for (auto it = root->children.begin(); it != root->children.end(); ++it) {
+        if (!*it) {
+          continue;
+        }
+        TrieNode_instance *child = (*it).get();
+        for (auto it2 = child->children.begin(); it2 != child->children.end();
+             ++it2) {
+          if (*it2) {
+            root_table[root_table_slot(child->prefixed_by,
+                                       (*it2)->prefixed_by)] = (*it2).get();
+          }
+        }
+      }
+    }
+  }
+
+  // Returns the shared_ptr that owns the given node, so that it can be kept
+  // alive by an iterator.
+  std::shared_ptr<TrieNode_instance>
+  owning_pointer(TrieNode_instance *node) const {
+    if (!node) {
+      return nullptr;
+    }
+    if (node == root.get()) {
+      return root;
+    }
+    return node->parent->children[node->prefixed_by];
+  }
+
+  // Returns a pointer to the node corresponding
+  // to the specified key. If no such key exists in the trie,
+  // nullptr is returned.
+  // KeyType or any HeterogeneousKey.
+  template <typename K> TrieNode_instance *find_node(const K &key) const {
+    return find_node(key, Converter::size(key));
+  }
+
+  // Returns a pointer to the node corresponding
+  // to the specified key. If no such key exists in the trie,
+  // nullptr is returned. Only the first key_size symbols of the key are
+  // considered.
+  // Raw pointers are used for the descent because copying shared_ptrs would
+  // modify the reference counts of every node on the path.
+  template <typename K>
+  TrieNode_instance *find_node(const K &key, const std::size_t key_size) const {
+    TrieNode_instance *current_node = root.get();
+    std::size_t pos_in_key = 0;
+
+    if constexpr (root_table_size > 0) {
+      if (key_size >= 2) {
+        current_node = root_table[root_table_slot(
+            Converter::get_at_index(key, 0), Converter::get_at_index(key, 1))];
+        if (!current_node) {
+          return nullptr;
+        }
+        pos_in_key = 2;
+      }
+    }
+
+    for (; pos_in_key != key_size; pos_in_key++) {
+      KeyContent next_node_index = Converter::get_at_index(key, pos_in_key);
+      if (!current_node->has_child(next_node_index)) {
+        return nullptr;
+      }
+      current_node = current_node->children[next_node_index].get();
+    }
+    return current_node;
+  }
+
+  static bool has_children(TrieNode_instance *node) {
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      if (*it) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Calls f(length, node) for every node with a value on the path of the key,
+  // shortest first. Stops where the path leaves the trie.
+  template <typename K, typename F>
+  void for_each_prefix_node(const K &key, F f) const {
+    TrieNode_instance *current_node = root.get();
+    std::size_t key_size = Converter::size(key);
+    for (std::size_t pos_in_key = 0;; pos_in_key++) {
+      if (values.has_value(current_node)) {
+        f(pos_in_key, current_node);
+      }
+      if (pos_in_key == key_size) {
+        return;
+      }
+      KeyContent next_node_index = Converter::get_at_index(key, pos_in_key);
+      if (!current_node->has_child(next_node_index)) {
+        return;
+      }
+      current_node = current_node->children[next_node_index].get();
+    }
+  }
+
+  template <typename K>
+  std::optional<std::pair<std::size_t, MappedType>>
+  longest_prefix_match_of(const K &key) const {
+    std::size_t length = 0;
+    TrieNode_instance *match = nullptr;
+    for_each_prefix_node(key, [&](std::size_t len, TrieNode_instance *node) {
+      length = len;
+      match = node;
+    });
+    if (!match) {
+      return std::nullopt;
+    }
+    return std::make_pair(length, *values.value(match));
+  }
+
+  template <typename K>
+  std::vector<std::pair<std::size_t, MappedType>>
+  all_prefix_matches_of(const K &key) const {
+    std::vector<std::pair<std::size_t, MappedType>> matches;
+    for_each_prefix_node(key, [&](std::size_t len, TrieNode_instance *node) {
+      matches.emplace_back(len, *values.value(node));
+    });
+    return matches;
+  }
+
+  template <typename K, typename OutputIt>
+  std::size_t tokenize_of(const K &text, OutputIt out,
+                          Unmatched fallback) const {
+    std::size_t text_size = Converter::size(text);
+    std::size_t unmatched = 0;
+    std::size_t pos = 0;
+    while (pos != text_size) {
+      // descend from the root for the longest key starting at pos
+      TrieNode_instance *current_node = root.get();
+      TrieNode_instance *match = nullptr;
+      std::size_t length = 0;
+      for (std::size_t end = pos; end != text_size; end++) {
+        KeyContent next_node_index = Converter::get_at_index(text, end);
+        if (!current_node->has_child(next_node_index)) {
+          break;
+        }
+        current_node = current_node->children[next_node_index].get();
+        if (values.has_value(current_node)) {
+          match = current_node;
+          length = end + 1 - pos;
+        }
+      }
+
+      if (match) {
+        if (unmatched) {
+          *out++ = Token{pos - unmatched, unmatched, nullptr};
+          unmatched = 0;
+        }
+        *out++ = Token{pos, length, &*values.value(match)};
+        pos += length;
+        continue;
+      }
+      switch (fallback) {
+      case Unmatched::skip:
+        break;
+      case Unmatched::single:
+        *out++ = Token{pos, 1, nullptr};
+        break;
+      case Unmatched::merge:
+        unmatched++;
+        break;
+      case Unmatched::stop:
+        return pos;
+      }
+      pos++;
     }
-
-    KeyType key() {
-      assert(current_node);
-      return current_node->key.value();
+    if (unmatched) {
+      *out++ = Token{pos - unmatched, unmatched, nullptr};
     }
+    return pos;
+  }
 
-    // A value can be modified via iterator.
-    ValueType &value() {
-      assert(current_node);
-      return current_node->elem.value();
+  template <typename K>
+  std::vector<FuzzyMatch> fuzzy_search_of(const K &query,
+                                          std::size_t max_edits) const {
+    std::vector<FuzzyMatch> matches;
+    std::size_t row_size = Converter::size(query) + 1;
+    // rows[depth * row_size + i] is the distance between the first i symbols
+    // of the query and the prefix of length depth that is being visited.
+    std::vector<std::size_t> rows(row_size);
+    for (std::size_t i = 0; i != row_size; i++) {
+      rows[i] = i;
     }
+    fuzzy_search_below(root.get(), 0, query, max_edits, rows, matches);
+    return matches;
+  }
 
-    Iterator &operator++() {
-      assert(current_node);
-      advance();
-      return *this;
+  template <typename K>
+  void fuzzy_search_below(TrieNode_instance *node, std::size_t depth,
+                          const K &query, std::size_t max_edits,
+                          std::vector<std::size_t> &rows,
+                          std::vector<FuzzyMatch> &matches) const {
+    std::size_t row_size = Converter::size(query) + 1;
+    std::size_t row = depth * row_size;
+    // the last entry is only computed if it is in the band (see below)
+    if (values.has_value(node) && depth + max_edits + 1 >= row_size &&
+        rows[row + row_size - 1] <= max_edits) {
+      matches.push_back(FuzzyMatch{values.key(node), rows[row + row_size - 1],
+                                   &*values.value(node)});
+    }
+    if (rows.size() < row + 2 * row_size) {
+      rows.resize(row + 2 * row_size);
+    }
+    std::size_t next = row + row_size;
+    // Entries of the child's row that are further than max_edits from its
+    // diagonal exceed max_edits, so only the band around the diagonal is
+    // computed. The entries just outside the band are set to max_edits + 1,
+    // which is a lower bound and as good as the exact value for the search.
+    std::size_t first = depth + 1 > max_edits ? depth + 1 - max_edits : 1;
+    std::size_t last = std::min(depth + 1 + max_edits, row_size - 1);
+    if (first > last + 1) {
+      return;
+    }
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      if (!*it) {
+        continue;
+      }
+      TrieNode_instance *child = (*it).get();
+      rows[next] = depth + 1;
+      rows[next + first - 1] = first == 1 ? depth + 1 : max_edits + 1;
+      std::size_t minimum = rows[next + first - 1];
+      for (std::size_t i = first; i <= last; i++) {
+        std::size_t substitution =
+            rows[row + i - 1] +
+            (Converter::get_at_index(query, i - 1) != child->prefixed_by);
+        rows[next + i] = std::min({rows[row + i] + 1, rows[next + i - 1] + 1,
+                                   substitution});
+        minimum = std::min(minimum, rows[next + i]);
+      }
+      if (last + 1 < row_size) {
+        rows[next + last + 1] = max_edits + 1;
+      }
+      if (minimum <= max_edits) {
+        fuzzy_search_below(child, depth + 1, query, max_edits, rows, matches);
+      }
     }
+  }
 
-    bool operator==(const Iterator &other) const {
-      return current_node == other.current_node;
+  void pattern_search_below(
+      TrieNode_instance *node, std::uint32_t state,
+      typename KeyPattern<KeyContent>::Matcher &matcher,
+      std::vector<std::pair<KeyType, const MappedType *>> &matches) const {
+    if (values.has_value(node) && matcher.accepts(state)) {
+      matches.emplace_back(values.key(node), &*values.value(node));
+    }
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      if (!*it) {
+        continue;
+      }
+      TrieNode_instance *child = (*it).get();
+      std::uint32_t next = matcher.step(state, child->prefixed_by);
+      if (next != matcher.dead) {
+        pattern_search_below(child, next, matcher, matches);
+      }
     }
+  }
 
-    bool operator!=(const Iterator &other) const { return !(*this == other); }
+  template <typename K>
+  std::vector<std::pair<KeyType, const MappedType *>>
+  top_k_of(const K &prefix, std::size_t k) const {
+    using Monoid = typename ValueStore::monoid_type;
+    using Score = typename Monoid::value_type;
+    struct Entry {
+      Score score;
+      TrieNode_instance *node;
+      // whether the entry stands for the subtrie or only the node's value
+      bool subtrie;
+    };
+    // values come before subtries with the same score, as they are done
+    auto lower = [](const Entry &e1, const Entry &e2) {
+      return e1.score < e2.score ||
+             (!(e2.score < e1.score) && e1.subtrie && !e2.subtrie);
+    };
+
+    std::vector<std::pair<KeyType, const MappedType *>> result;
+    TrieNode_instance *subroot = find_node(prefix);
+    if (!subroot || k == 0) {
+      return result;
+    }
+    std::priority_queue<Entry, std::vector<Entry>, decltype(lower)> queue(
+        lower);
+    queue.push({values.aggregate(subroot), subroot, true});
+    while (!queue.empty() && result.size() < k) {
+      Entry top = queue.top();
+      queue.pop();
+      if (!top.subtrie) {
+        result.emplace_back(values.key(top.node), &*values.value(top.node));
+        continue;
+      }
+      if (values.has_value(top.node)) {
+        queue.push({Monoid::lift(*values.value(top.node)), top.node, false});
+      }
+      for (auto it = top.node->children.begin();
+           it != top.node->children.end(); ++it) {
+        if (*it) {
+          queue.push({values.aggregate((*it).get()), (*it).get(), true});
+        }
+      }
+    }
+    return result;
+  }
 
-  private:
-    Iterator(std::shared_ptr<TrieNode_instance> root_node)
-        : current_node(leftmost_bottommost_node(root_node.get())),
-          root(root_node) {}
+  template <typename K> auto aggregate_of(const K &prefix) const {
+    TrieNode_instance *subroot = find_node(prefix);
+    return subroot ? values.aggregate(subroot)
+                   : ValueStore::monoid_type::identity();
+  }
 
-    Iterator() : current_node(nullptr), root(nullptr) {}
+  template <typename K> std::size_t count_prefix_of(const K &prefix) const {
+    TrieNode_instance *subroot = find_node(prefix);
+    return subroot ? ValueStore::monoid_type::count(values.aggregate(subroot))
+                   : 0;
+  }
 
-    void advance() { next_postorder(); }
+  template <typename K, typename Generator>
+  std::optional<std::pair<KeyType, const MappedType *>>
+  sample_of(const K &prefix, Generator &rng) const {
+    using Monoid = typename ValueStore::monoid_type;
+    TrieNode_instance *current_node = find_node(prefix);
+    if (!current_node) {
+      return std::nullopt;
+    }
+    std::size_t count = Monoid::count(values.aggregate(current_node));
+    if (count == 0) {
+      return std::nullopt;
+    }
+    std::size_t i =
+        std::uniform_int_distribution<std::size_t>(0, count - 1)(rng);
+    // like select(), but without the stack of an iterator
+    while (true) {
+      if (values.has_value(current_node)) {
+        if (i == 0) {
+          return std::make_pair(values.key(current_node),
+                                &*values.value(current_node));
+        }
+        i--;
+      }
+      for (auto child = current_node->children.begin();
+           child != current_node->children.end(); ++child) {
+        if (!*child) {
+          continue;
+        }
+        count = Monoid::count(values.aggregate((*child).get()));
+        if (i < count) {
+          current_node = (*child).get();
+          break;
+        }
+        i -= count;
+      }
+    }
+  }
 
-    void next_postorder() {
-      if (current_node == root.get()) {
-        current_node = nullptr;
-        return;
+  template <typename K, typename Generator>
+  std::vector<std::pair<KeyType, const MappedType *>>
+  sample_of(const K &prefix, std::size_t k, Generator &rng) const {
+    using Monoid = typename ValueStore::monoid_type;
+    std::vector<std::pair<KeyType, const MappedType *>> result;
+    TrieNode_instance *subroot = find_node(prefix);
+    if (!subroot || k == 0) {
+      return result;
+    }
+    std::size_t count = Monoid::count(values.aggregate(subroot));
+    std::vector<std::size_t> ranks;
+    if (k >= count) {
+      ranks.resize(count);
+      std::iota(ranks.begin(), ranks.end(), std::size_t{0});
+    } else {
+      // Floyd's algorithm: k distinct ranks with k random numbers
+      std::unordered_set<std::size_t> drawn;
+      for (std::size_t j = count - k; j != count; j++) {
+        std::size_t rank =
+            std::uniform_int_distribution<std::size_t>(0, j)(rng);
+        drawn.insert(drawn.insert(rank).second ? rank : j);
       }
+      ranks.assign(drawn.begin(), drawn.end());
+      std::sort(ranks.begin(), ranks.end());
+    }
+    if (!ranks.empty()) {
+      result.reserve(ranks.size());
+      sample_below(subroot, ranks.cbegin(), ranks.cend(), 0, result);
+    }
+    return result;
+  }
 
-      // go to parent; find the leftmost node in all subtries to the right that
-      // has a value.
-      auto child_it =
-          current_node->parent->children.find(current_node->prefixed_by);
-      ++child_it;
-      for (; child_it != current_node->parent->children.end(); ++child_it) {
-        TrieNode_instance *next = leftmost_bottommost_node((*child_it).get());
-        if (next && next->elem.has_value()) {
-          current_node = next;
+  // Appends the keys with the ranks [first, last) to result, where ranks
+  // are sorted, not empty and counted from offset at node.
+  void sample_below(
+      TrieNode_instance *node, std::vector<std::size_t>::const_iterator first,
+      std::vector<std::size_t>::const_iterator last, std::size_t offset,
+      std::vector<std::pair<KeyType, const MappedType *>> &result) const {
+    using Monoid = typename ValueStore::monoid_type;
+    if (values.has_value(node)) {
+      if (*first == offset) {
+        result.emplace_back(values.key(node), &*values.value(node));
+        if (++first == last) {
           return;
         }
       }
+      offset++;
+    }
+    for (auto child = node->children.begin(); child != node->children.end();
+         ++child) {
+      if (!*child) {
+        continue;
+      }
+      std::size_t count = Monoid::count(values.aggregate((*child).get()));
+      auto split = std::lower_bound(first, last, offset + count);
+      if (split != first) {
+        sample_below((*child).get(), first, split, offset, result);
+        first = split;
+        if (first == last) {
+          return;
+        }
+      }
+      offset += count;
+    }
+  }
 
-      // if there is no node in the subtries to the right with a value, go to
-      // parent.
-      if (current_node->parent->elem.has_value()) {
-        current_node = current_node->parent;
-        return;
+  // Positions an OrderedIterator at the first key that is not less than key
+  // (or greater than key if skip_equal is set). The descent follows the key
+  // and leaves every frame's next_child at the first child after the key's
+  // symbol, so that advancing continues behind the key.
+  OrderedIterator seek(const KeyType &key, bool skip_equal) const {
+    OrderedIterator it(&mutable_values());
+    std::size_t key_size = Converter::size(key);
+    it.stack.reserve(key_size + 1);
+    it.stack.push_back({root.get(), root->children.begin()});
+    for (std::size_t pos_in_key = 0; pos_in_key != key_size; pos_in_key++) {
+      typename OrderedIterator::Frame &top = it.stack.back();
+      KeyContent next_node_index = Converter::get_at_index(key, pos_in_key);
+      top.next_child = top.node->children.lower_bound(next_node_index);
+      if (!(top.next_child != top.node->children.end()) || !*top.next_child ||
+          (*top.next_child)->prefixed_by != next_node_index) {
+        // all keys in the subtries from next_child on are greater than key
+        it.advance();
+        return it;
       }
+      TrieNode_instance *child = (*top.next_child).get();
+      ++top.next_child;
+      it.stack.push_back({child, child->children.begin()});
+    }
+    if (skip_equal || !values.has_value(it.stack.back().node)) {
+      it.advance();
+    }
+    return it;
+  }
 
-      // if parent has no value either, go one step up and continue search.
-      current_node = current_node->parent;
-      next_postorder();
+  // Like find_node, but resumes the descent of the last lookup made with the
+  // finger and updates the finger.
+  TrieNode_instance *find_node(const KeyType &key, Finger &finger) const {
+    if (finger.path.empty() || finger.path.front() != root.get()) {
+      finger.path.assign(1, root.get());
     }
+    std::size_t key_size = Converter::size(key);
+    std::size_t common = 0;
+    std::size_t limit = std::min(key_size, finger.path.size() - 1);
+    while (common != limit && finger.path[common + 1]->prefixed_by ==
+                                  Converter::get_at_index(key, common)) {
+      common++;
+    }
+    finger.path.resize(common + 1);
 
-    // Returns a pointer to the leftmost-bottommost node with an attached
-    // element in the structure where subroot is the root node. (i.e. the one
-    // that is to be traversed first in this structure). If there are no
-    // children, return nullptr
-    static TrieNode_instance *
-    leftmost_bottommost_node(TrieNode_instance *subroot) {
-      if (!subroot) {
+    TrieNode_instance *current_node = finger.path.back();
+    for (std::size_t pos_in_key = common; pos_in_key != key_size;
+         pos_in_key++) {
+      KeyContent next_node_index = Converter::get_at_index(key, pos_in_key);
+      if (!current_node->has_child(next_node_index)) {
         return nullptr;
       }
+      current_node = current_node->children[next_node_index].get();
+      finger.path.push_back(current_node);
+    }
+    return current_node;
+  }
+
+  static std::size_t count_nodes(TrieNode_instance *node) {
+    std::size_t count = 1;
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      if (*it) {
+        count += count_nodes((*it).get());
+      }
+    }
+    return count;
+  }
 
-      TrieNode_instance *leftmost = nullptr;
-      for (auto it = subroot->children.begin(); it != subroot->children.end();
-           ++it) {
-        leftmost = leftmost_bottommost_node((*it).get());
-        if (leftmost && leftmost->elem.has_value()) {
-          return leftmost;
+  // Allocates a new node that takes over the element and key of node, but
+  // none of its children.
+  static std::shared_ptr<TrieNode_instance>
+  relocate_node(TrieNode_instance *node, TrieNode_instance *parent,
+                const NodeArenaAllocator<TrieNode_instance> &allocator) {
+    std::shared_ptr<TrieNode_instance> relocated =
+        std::allocate_shared<TrieNode_instance>(allocator, parent,
+                                                node->prefixed_by);
+    relocated->elem = std::move(node->elem);
+    relocated->key = std::move(node->key);
+    return relocated;
+  }
+
+  // Moves the subtries below node to relocated. All children of a node are
+  // allocated next to each other, followed by the subtries below them in
+  // depth-first order.
+  // The old nodes are released only after everything has been moved:
+  // Releasing them earlier would let the storages' own allocations (e.g. the
+  // nodes of a std::map) reuse the freed memory, scattering them again.
+  static void
+  relocate_children(TrieNode_instance *node, TrieNode_instance *relocated,
+                    const NodeArenaAllocator<TrieNode_instance> &allocator) {
+    // pairs of (old child, relocated child)
+    std::vector<std::pair<TrieNode_instance *, TrieNode_instance *>> children;
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      if (*it) {
+        auto child = relocate_node((*it).get(), relocated, allocator);
+        children.emplace_back((*it).get(), child.get());
+        relocated->children[child->prefixed_by] = std::move(child);
+      }
+    }
+    for (auto [child, relocated_child] : children) {
+      relocate_children(child, relocated_child, allocator);
+    }
+  }
+
+  // Deletes the given node and all of its ancestors (except for the root) that
+  // neither have an element nor any children.
+  void prune(TrieNode_instance *node) {
+    while (node != root.get() && !values.has_value(node) &&
+           !has_children(node)) {
+      TrieNode_instance *parent = node->parent;
+      values.release(node);
+      if constexpr (root_table_size > 0) {
+        if (parent != root.get() && parent->parent == root.get()) {
+          root_table[root_table_slot(parent->prefixed_by, node->prefixed_by)] =
+              nullptr;
         }
       }
-      return subroot->elem.has_value() ? subroot : nullptr;
+      parent->children.erase(node->prefixed_by);
+      node = parent;
     }
+  }
 
-    TrieNode_instance *current_node;
-    const std::shared_ptr<TrieNode_instance> root;
-  };
+  // Merges the subtrie of other_node, whose values are in other_values, into
+  // the subtrie of node. Both nodes correspond to the same prefix.
+  template <typename Resolve>
+  void merge_below(TrieNode_instance *node, TrieNode_instance *other_node,
+                   ValueStore &other_values, Resolve &resolve) {
+    if (other_values.has_value(other_node)) {
+      std::optional<MappedType> &other_value = other_values.value(other_node);
+      if (values.has_value(node)) {
+        std::optional<MappedType> &value = values.value(node);
+        value = resolve(std::move(*value), std::move(*other_value));
+      } else {
+        values.set_key(node, other_values.key(other_node));
+        values.value(node) = std::move(other_value);
+      }
+    }
+    for (auto it = other_node->children.begin();
+         it != other_node->children.end(); ++it) {
+      if (!*it) {
+        continue;
+      }
+      KeyContent symbol = (*it)->prefixed_by;
+      if (node->has_child(symbol)) {
+        merge_below((*node->children.find(symbol)).get(), (*it).get(),
+                    other_values, resolve);
+        continue;
+      }
+      // other is emptied afterwards, so its child can be taken away
+      std::shared_ptr<TrieNode_instance> child = std::move(*it);
+      child->parent = node;
+      node->children[symbol] = child;
+      values.adopt(child.get(), other_values);
+    }
+  }
+
+  // Removes the keys below node that are not below other_node, which
+  // corresponds to the same prefix in another trie.
+  void intersect_below(TrieNode_instance *node, TrieNode_instance *other_node,
+                       const ValueStore &other_values) {
+    if (values.has_value(node) && !other_values.has_value(other_node)) {
+      values.value(node).reset();
+      values.release(node);
+    }
+    std::vector<KeyContent> emptied;
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      if (!*it) {
+        continue;
+      }
+      KeyContent symbol = (*it)->prefixed_by;
+      if (!other_node->has_child(symbol)) {
+        release_subtrie((*it).get());
+        emptied.push_back(symbol);
+        continue;
+      }
+      intersect_below((*it).get(), (*other_node->children.find(symbol)).get(),
+                      other_values);
+      if (!values.has_value((*it).get()) && !has_children((*it).get())) {
+        emptied.push_back(symbol);
+      }
+    }
+    // erasing while iterating would invalidate the iterator
+    for (KeyContent symbol : emptied) {
+      node->children.erase(symbol);
+    }
+  }
+
+  // Removes the keys below node that are also below other_node, which
+  // corresponds to the same prefix in another trie.
+  void difference_below(TrieNode_instance *node, TrieNode_instance *other_node,
+                        const ValueStore &other_values) {
+    if (values.has_value(node) && other_values.has_value(other_node)) {
+      values.value(node).reset();
+      values.release(node);
+    }
+    std::vector<KeyContent> emptied;
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      if (!*it) {
+        continue;
+      }
+      KeyContent symbol = (*it)->prefixed_by;
+      if (!other_node->has_child(symbol)) {
+        continue;
+      }
+      difference_below((*it).get(), (*other_node->children.find(symbol)).get(),
+                       other_values);
+      if (!values.has_value((*it).get()) && !has_children((*it).get())) {
+        emptied.push_back(symbol);
+      }
+    }
+    for (KeyContent symbol : emptied) {
+      node->children.erase(symbol);
+    }
+  }
+
+  // Releases the keys and values of all nodes in the subtrie of node before
+  // the subtrie is dropped.
+  void release_subtrie(TrieNode_instance *node) {
+    values.release(node);
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      if (*it) {
+        release_subtrie((*it).get());
+      }
+    }
+  }
+
+  template <typename K> MappedType *find_value(const K &key) const {
+    TrieNode_instance *target_node = find_node(key);
+    return target_node && values.has_value(target_node)
+               ? &*mutable_values().value(target_node)
+               : nullptr;
+  }
+
+  template <typename K, typename... Args>
+  std::pair<MappedType *, bool>
+  try_emplace_at(TrieNode_instance *node, K &&key, Args &&...args) {
+    std::optional<MappedType> &value = values.value(node);
+    if (value.has_value()) {
+      return {&*value, false};
+    }
+    value.emplace(std::forward<Args>(args)...);
+    values.set_key(node, std::forward<K>(key));
+    return {&*value, true};
+  }
+
+  template <typename K, typename M>
+  std::pair<MappedType *, bool>
+  insert_or_assign_at(TrieNode_instance *node, K &&key, M &&to_assign) {
+    std::optional<MappedType> &value = values.value(node);
+    if (value.has_value()) {
+      *value = std::forward<M>(to_assign);
+      return {&*value, false};
+    }
+    value.emplace(std::forward<M>(to_assign));
+    values.set_key(node, std::forward<K>(key));
+    return {&*value, true};
+  }
+
+  // Makes a path to the node corresponding to the key.
+  // If the entire path or parts are already available,
+  // they are reused. The key is not stored in the node.
+  TrieNode_instance *mk_path_to_node(const KeyType &key) {
+    TrieNode_instance *current_node = root.get();
+    std::size_t key_size = Converter::size(key);
+    std::size_t pos_in_key = 0;
+
+    if constexpr (root_table_size > 0) {
+      if (key_size >= 2) {
+        TrieNode_instance *cached = root_table[root_table_slot(
+            Converter::get_at_index(key, 0), Converter::get_at_index(key, 1))];
+        if (cached) {
+          current_node = cached;
+          pos_in_key = 2;
+        }
+      }
+    }
+
+    for (; pos_in_key != key_size; pos_in_key++) {
+      KeyContent next_node_index = Converter::get_at_index(key, pos_in_key);
+
+      if (!current_node->has_child(next_node_index)) {
+        current_node->children[next_node_index] =
+            std::shared_ptr<TrieNode_instance>(
+                new TrieNode_instance(current_node, next_node_index));
+      }
+      current_node = current_node->children[next_node_index].get();
+
+      if constexpr (root_table_size > 0) {
+        if (pos_in_key == 1) {
+          root_table[root_table_slot(current_node->parent->prefixed_by,
+                                     current_node->prefixed_by)] =
+              current_node;
+        }
+      }
+    }
+    return current_node;
+  }
+};
 
+// A set of keys, i.e. a trie without values. Every node only stores a single
+// terminal flag instead of a value and a copy of the key, so TrieSet needs
+// much less memory than e.g. a Trie<KeyType, bool>.
+// Keys are not stored at all; they are reconstructed from the path when
+// enumerating the set, which requires KeyType to be constructible from a range
+// of symbols (like std::string and std::vector).
+// The template parameters have the same meaning as for Trie. Note that the
+// storage's ValueType must be void, e.g. MapStorage<std::string, char, void>.
+template <typename KeyType,
+          ConverterType<KeyType> Converter = DummyConverter<KeyType>,
+          StorageType<KeyType, typename Converter::KeyContent, void> Storage =
+              MapStorage<KeyType, typename Converter::KeyContent, void>>
+class TrieSet {
 private:
-  std::shared_ptr<TrieNode_instance> root;
+  using KeyContent = typename Converter::KeyContent;
+  using TrieNode_instance = TrieNode<KeyType, KeyContent, void, Storage>;
 
-  // internal constructor for making a subtrie
-  Trie(std::shared_ptr<TrieNode_instance> root) : root(root) {}
+public:
+  class Iterator;
 
-  // Returns a shared_ptr pointing to the node corresponding
-  // to the specified key. If no such key exists in the trie,
-  // nullptr is returned.
-  std::shared_ptr<TrieNode_instance> find_node(const KeyType &key) const {
-    return find_node(key, Converter::size(key));
+  TrieSet()
+      : root(std::make_shared<TrieNode_instance>(nullptr, KeyContent{})) {}
+
+  TrieSet(const TrieSet &set)
+      : root(std::make_shared<TrieNode_instance>(*set.root)) {}
+
+  TrieSet(TrieSet &&other) { swap(*this, other); }
+
+  ~TrieSet() {}
+
+  friend void swap(TrieSet &s1, TrieSet &s2) { std::swap(s1.root, s2.root); }
+
+  TrieSet &operator=(const TrieSet &other) { return *this = TrieSet(other); }
+
+  TrieSet &operator=(TrieSet &&other) {
+    swap(*this, other);
+    return *this;
   }
 
-  // Returns a shared_ptr pointing to the node corresponding
-  // to the specified key. If no such key exists in the trie,
-  // nullptr is returned. Only the first key_size symbols of the key are
-  // considered.
-  std::shared_ptr<TrieNode_instance>
-  find_node(const KeyType &key, const std::size_t key_size) const {
-    std::shared_ptr<TrieNode_instance> current_node = root;
+  // Adds a key to the set. Returns true if the key was not in the set before.
+  bool insert(const KeyType &key) {
+    TrieNode_instance *node = mk_path_to_node(key);
+    bool inserted = !node->elem.terminal;
+    node->elem.terminal = true;
+    return inserted;
+  }
+
+  bool contains(const KeyType &key) const {
+    TrieNode_instance *node = find_node(key, Converter::size(key));
+    return node && node->elem.terminal;
+  }
+
+  // Like Trie::has_key, this also accepts other key types.
+  template <HeterogeneousKey<KeyType, Converter> K>
+  bool contains(const K &key) const {
+    TrieNode_instance *node = find_node(key, Converter::size(key));
+    return node && node->elem.terminal;
+  }
+
+  bool contains(const KeyContent *key) const
+      requires CStringKeyContent<KeyContent, Converter> {
+    return contains(std::basic_string_view<KeyContent>(key));
+  }
+
+  // Removes a key from the set. Returns true if the key was in the set.
+  bool erase(const KeyType &key) {
+    TrieNode_instance *node = find_node(key, Converter::size(key));
+    if (!node || !node->elem.terminal) {
+      return false;
+    }
+    node->elem.terminal = false;
+    while (node != root.get() && !node->elem.terminal && !has_children(node)) {
+      TrieNode_instance *parent = node->parent;
+      parent->children.erase(node->prefixed_by);
+      node = parent;
+    }
+    return true;
+  }
+
+  // Keys are enumerated in the same order as by Trie::Iterator.
+  Iterator begin() const { return Iterator(root, {}); }
+
+  Iterator end() const { return Iterator(); }
+
+  // Enumerates all keys starting with the given prefix.
+  Iterator subtrie_iterator(const KeyType &prefix) const {
+    return subtrie_iterator(prefix, Converter::size(prefix));
+  }
+
+  // Enumerates all keys starting with the first len symbols of prefix.
+  Iterator subtrie_iterator(const KeyType &prefix, std::size_t len) const {
+    TrieNode_instance *subroot = find_node(prefix, len);
+    if (!subroot) {
+      return end();
+    }
+    std::vector<KeyContent> symbols;
+    symbols.reserve(len);
+    for (std::size_t pos_in_key = 0; pos_in_key != len; pos_in_key++) {
+      symbols.push_back(Converter::get_at_index(prefix, pos_in_key));
+    }
+    std::shared_ptr<TrieNode_instance> owner =
+        subroot == root.get()
+            ? root
+            : subroot->parent->children[subroot->prefixed_by];
+    return Iterator(owner, std::move(symbols));
+  }
+
+  class Iterator {
+    friend class TrieSet<KeyType, Converter, Storage>;
+
+  public:
+    KeyType operator*() const requires std::constructible_from<
+        KeyType, typename std::vector<KeyContent>::const_iterator,
+        typename std::vector<KeyContent>::const_iterator> {
+      assert(!stack.empty());
+      return KeyType(symbols.begin(), symbols.end());
+    }
+
+    Iterator &operator++() {
+      assert(!stack.empty());
+      pop();
+      descend();
+      return *this;
+    }
+
+    bool operator==(const Iterator &other) const {
+      return current_node() == other.current_node();
+    }
+
+    bool operator!=(const Iterator &other) const { return !(*this == other); }
+
+  private:
+    using ChildIterator = decltype(std::declval<Storage &>().begin());
+
+    struct Frame {
+      TrieNode_instance *node;
+      ChildIterator next_child;
+    };
+
+    Iterator(std::shared_ptr<TrieNode_instance> subroot,
+             std::vector<KeyContent> prefix)
+        : subroot(subroot), stack(), symbols(std::move(prefix)) {
+      stack.push_back(Frame{subroot.get(), subroot->children.begin()});
+      descend();
+    }
+
+    Iterator() : subroot(nullptr), stack(), symbols() {}
+
+    TrieNode_instance *current_node() const {
+      return stack.empty() ? nullptr : stack.back().node;
+    }
+
+    void pop() {
+      if (stack.size() > 1) {
+        symbols.pop_back();
+      }
+      stack.pop_back();
+    }
+
+    // Moves to the next node in post-order that is terminal, using an explicit
+    // stack so that the symbols of the current key are always at hand.
+    void descend() {
+      while (!stack.empty()) {
+        Frame &top = stack.back();
+        while (top.next_child != top.node->children.end() &&
+               !*top.next_child) {
+          ++top.next_child;
+        }
+        if (top.next_child != top.node->children.end()) {
+          TrieNode_instance *child = (*top.next_child).get();
+          ++top.next_child;
+          symbols.push_back(child->prefixed_by);
+          stack.push_back(Frame{child, child->children.begin()});
+        } else if (top.node->elem.terminal) {
+          return;
+        } else {
+          pop();
+        }
+      }
+    }
+
+    std::shared_ptr<TrieNode_instance> subroot;
+    std::vector<Frame> stack;
+    std::vector<KeyContent> symbols;
+  };
 
+private:
+  std::shared_ptr<TrieNode_instance> root;
+
+  template <typename K>
+  TrieNode_instance *find_node(const K &key, const std::size_t key_size) const {
+    TrieNode_instance *current_node = root.get();
     for (std::size_t pos_in_key = 0; pos_in_key != key_size; pos_in_key++) {
       KeyContent next_node_index = Converter::get_at_index(key, pos_in_key);
       if (!current_node->has_child(next_node_index)) {
         return nullptr;
       }
-      current_node = current_node->children[next_node_index];
+      current_node = current_node->children[next_node_index].get();
     }
     return current_node;
   }
 
-  // Makes a path to the node corresponding to the key.
-  // If the entire path or parts are already available,
-  // they are reused.
-  std::shared_ptr<TrieNode_instance> mk_path_to_node(const KeyType &key) {
-    std::shared_ptr<TrieNode_instance> current_node = root;
-    std::size_t key_size = Converter::size(key);
+  static bool has_children(TrieNode_instance *node) {
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      if (*it) {
+        return true;
+      }
+    }
+    return false;
+  }
 
+  TrieNode_instance *mk_path_to_node(const KeyType &key) {
+    TrieNode_instance *current_node = root.get();
+    std::size_t key_size = Converter::size(key);
     for (std::size_t pos_in_key = 0; pos_in_key != key_size; pos_in_key++) {
       KeyContent next_node_index = Converter::get_at_index(key, pos_in_key);
-
       if (!current_node->has_child(next_node_index)) {
+        // make_shared saves a separate allocation for the control block.
         current_node->children[next_node_index] =
-            std::shared_ptr<TrieNode_instance>(
-                new TrieNode_instance(current_node.get(), next_node_index));
+            std::make_shared<TrieNode_instance>(current_node, next_node_index);
       }
-      current_node = current_node->children[next_node_index];
+      current_node = current_node->children[next_node_index].get();
     }
-    current_node->key = key;
     return current_node;
   }
 };